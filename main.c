@@ -6,6 +6,23 @@
 // the amount of malloc/free calls), uncomment the following line:
 // #define MEM_STATS
 
+// To run the benchmarks instead of the demo tests, uncomment the following
+// line (or build with -DBENCHMARK). It implies MEM_STATS
+// #define BENCHMARK
+
+#ifdef BENCHMARK
+#define MEM_STATS
+#endif
+
+// To check after every rewrite that no two lambdas share a binder, uncomment
+// the following line (or build with -DCHECK_BINDERS). It sorts every binder
+// of the term each step, so it's only meant for debugging
+// #define CHECK_BINDERS
+
+// To keep the evaluated prelude in a file and map it on later runs instead of
+// evaluating it again, uncomment the following line (see PRELUDE IMAGE)
+// #define PRELUDE_IMAGE "prelude.img"
+
 // Main source:
 // https://personal.utdallas.edu/~gupta/courses/apl/lambda.pdf
 //
@@ -20,17 +37,42 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef BENCHMARK
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#endif
 
 #ifdef MEM_STATS
+// Batches evaluate on several threads at once (see CONTEXTS), so these are
+// only ever changed atomically
+#define statAdd(counter, n) __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+
+static inline void statMax(int64_t *peak, int64_t value) {
+    int64_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while(value > seen && !__atomic_compare_exchange_n(peak, &seen, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
 int64_t finalCount;
 int64_t peakCount;
 int64_t mallocCount;
 int64_t freeCount;
 
+int64_t arenaBytes;
+int64_t arenaReused;
+int64_t arenaReserved;
+int64_t arenaPeak;
+
 void *Malloc(size_t size) {
-    mallocCount++;
-    finalCount++;
-    if(finalCount > peakCount) peakCount = finalCount;
+    statAdd(mallocCount, 1);
+    statMax(&peakCount, statAdd(finalCount, 1));
 
     // return calloc(1, size);
     return malloc(size);
@@ -43,8 +85,8 @@ void *Realloc(void *ptr, size_t size) {
 void Free(void *ptr) {
     if(ptr == 0) return;
 
-    freeCount++;
-    finalCount--;
+    statAdd(freeCount, 1);
+    statAdd(finalCount, -1);
 
     free(ptr);
 }
@@ -60,15 +102,45 @@ void Free(void *ptr) {
 
 typedef uint8_t byte;
 
-// EXPR_BIND is implied to be everything not within [0; 3]
+// Every node starts with a one byte tag. Binders are 64 bit ids stored
+// right after the EXPR_BIND or EXPR_FUN tag, impure values carry a 32 bit
+// length, impure functions are an index into impureTable and shared terms an
+// index into sharedTable. Nothing is aligned, fields are read and written
+// through readField/writeField
+typedef uint8_t exprType;
 typedef uint64_t bindt;
-typedef bindt exprType;
+typedef uint32_t vlent;
+typedef uint32_t impureId;
+typedef uint32_t refId;
 #define EXPR_FUN 0
 #define EXPR_APP 1
 #define EXPR_IMPURE_VAL 2
 #define EXPR_IMPURE_FUN 3
-bindt lastBind = 4;
-#define var(b) if(lastBind < 4) { lastBind = 4; } bindt b = lastBind++;
+#define EXPR_BIND 4
+#define EXPR_REF 5
+
+// Every thread takes binders from a range of BIND_RANGE of its own, so terms
+// made on different threads never share one. The ranges are handed out in
+// order from 4 on. Terms rely on every binder being fresh (see
+// makeUniqueBindings), so running out of them is fatal rather than wrapping
+// around, which at 64 bits takes a few hundred thousand years
+#define BIND_RANGE (1 << 20)
+uint64_t bindRanges = 0;
+_Thread_local bindt lastBind = 0;
+_Thread_local bindt bindLimit = 0;
+
+void bindRange() {
+    uint64_t range = __atomic_fetch_add(&bindRanges, 1, __ATOMIC_RELAXED);
+    if(range >= (UINT64_MAX - 4) / BIND_RANGE) {
+        printf("Ran out of binders\n");
+        exit(1);
+    }
+
+    lastBind = 4 + range * BIND_RANGE;
+    bindLimit = lastBind + BIND_RANGE;
+}
+
+#define var(b) if(lastBind >= bindLimit) { bindRange(); } bindt b = lastBind++;
 
 typedef struct {
     byte *data;
@@ -78,15 +150,194 @@ typedef struct {
 
 typedef expr (*impureFunpt)(byte *data, size_t len);
 
+#define readField(ty, p) ({ ty __field; memcpy(&__field, (p), sizeof(ty)); __field; })
+#define writeField(ty, p, v) { ty __field = (v); memcpy((p), &__field, sizeof(ty)); }
+
+#define BIND_LEN (sizeof(exprType) + sizeof(bindt))
+#define FUN_LEN (sizeof(exprType) + sizeof(bindt))
+#define IMPURE_FUN_LEN (sizeof(exprType) + sizeof(impureId))
+#define REF_LEN (sizeof(exprType) + sizeof(refId))
+#define impureValLen(data) (sizeof(exprType) + sizeof(vlent) + readField(vlent, (data) + sizeof(exprType)))
+
+// ==================
+// ARENA
+// ==================
+
+// Bump allocator for everything that only lives as long as one evaluation or
+// one definition. Chunks double in size; resetting keeps them around so the
+// next scope reuses them, releasing hands them back to the system
+
+typedef struct arenaChunk {
+    struct arenaChunk *next;
+    size_t used;
+    size_t cap;
+    byte data[];
+} arenaChunk;
+
+typedef struct {
+    arenaChunk *chunks;
+    arenaChunk *free;
+} arena;
+
+#define ARENA_CHUNK_MIN (64 * 1024)
+#define ARENA_ALIGN (sizeof(size_t))
+
+_Thread_local arena *currentArena = NULL;
+
+void *arenaAlloc(arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    arenaChunk *chunk = a->chunks;
+    if(chunk != NULL && chunk->cap - chunk->used >= size) {
+        void *ptr = chunk->data + chunk->used;
+        chunk->used += size;
+#ifdef MEM_STATS
+        statAdd(arenaBytes, size);
+#endif
+        return ptr;
+    }
+
+    arenaChunk **prev = &a->free;
+    while(*prev != NULL && (*prev)->cap < size) prev = &(*prev)->next;
+
+    if(*prev != NULL) {
+        chunk = *prev;
+        *prev = chunk->next;
+#ifdef MEM_STATS
+        statAdd(arenaReused, size);
+#endif
+    }
+    else {
+        size_t cap = chunk == NULL ? ARENA_CHUNK_MIN : chunk->cap * 2;
+        while(cap < size) cap *= 2;
+
+        chunk = Malloc(sizeof(arenaChunk) + cap);
+        chunk->cap = cap;
+#ifdef MEM_STATS
+        statMax(&arenaPeak, statAdd(arenaReserved, cap));
+#endif
+    }
+
+    chunk->used = size;
+    chunk->next = a->chunks;
+    a->chunks = chunk;
+
+#ifdef MEM_STATS
+    statAdd(arenaBytes, size);
+#endif
+    return chunk->data;
+}
+
+bool arenaOwns(arena *a, void *ptr) {
+    for(arenaChunk *chunk = a->chunks; chunk != NULL; chunk = chunk->next) {
+        if((byte *)ptr >= chunk->data && (byte *)ptr < chunk->data + chunk->cap) return true;
+    }
+    return false;
+}
+
+// Everything allocated since the last reset is gone, the chunks stay
+void arenaReset(arena *a) {
+    while(a->chunks != NULL) {
+        arenaChunk *chunk = a->chunks;
+        a->chunks = chunk->next;
+        chunk->next = a->free;
+        a->free = chunk;
+    }
+}
+
+void arenaRelease(arena *a) {
+    arenaReset(a);
+    while(a->free != NULL) {
+        arenaChunk *chunk = a->free;
+        a->free = chunk->next;
+#ifdef MEM_STATS
+        statAdd(arenaReserved, -(int64_t)chunk->cap);
+#endif
+        Free(chunk);
+    }
+}
+
+arena *arenaEnter(arena *a) {
+    arena *prev = currentArena;
+    currentArena = a;
+    return prev;
+}
+
+void arenaLeave(arena *prev) {
+    currentArena = prev;
+}
+
+// Term storage goes to the current arena if there is one. Freeing arena
+// memory is a no-op, it goes away with the whole scope
+void *termAlloc(size_t size) {
+    if(currentArena != NULL) return arenaAlloc(currentArena, size);
+    return Malloc(size);
+}
+
+void termFree(void *ptr) {
+    if(ptr == NULL) return;
+    if(currentArena != NULL && arenaOwns(currentArena, ptr)) return;
+    Free(ptr);
+}
+
+// Moves a term out of the current arena onto the heap
+expr termDetach(expr e) {
+    if(currentArena == NULL || !arenaOwns(currentArena, e.data)) return e;
+
+    byte *data = Malloc(e.len);
+    memcpy(data, e.data, e.len);
+    e.data = data;
+    return e;
+}
+
 // ==================
 // UTILITY
 // ==================
 
 void maybeFree(expr e) {
-    if(e.aux) Free(e.data);
+    if(e.aux) termFree(e.data);
+}
+
+#define isBind(t) ((t) == EXPR_BIND)
+
+#define IMPURE_MAX 256
+impureFunpt impureTable[IMPURE_MAX];
+impureId impureCount = 0;
+
+// Set by DefunImpure, so a prelude image can refer to them by name
+const char *impureNames[IMPURE_MAX];
+
+impureId registerImpure(impureFunpt fun) {
+    for(impureId i = 0; i < impureCount; i++) {
+        if(impureTable[i] == fun) return i;
+    }
+
+    if(impureCount == IMPURE_MAX) {
+        printf("Too many impure functions (at most %d)\n", IMPURE_MAX);
+        exit(1);
+    }
+
+    impureTable[impureCount] = fun;
+    return impureCount++;
 }
 
-#define isBind(t) ((t) >= 4)
+#define impureAt(data) (impureTable[readField(impureId, data)])
+
+// Hash-consed closed terms (see SHARING). Each one is kept once, in named form
+// to be copied into a term being rewritten and in de Bruijn form as its
+// alpha-equivalence key; terms that mention it only hold an EXPR_REF node
+typedef struct {
+    expr term;
+    expr canon;
+    uint64_t hash;
+    bool normal;
+} sharedTerm;
+
+sharedTerm *sharedTable = NULL;
+refId sharedCount = 0;
+refId sharedCap = 0;
+
+#define sharedAt(data) (&sharedTable[readField(refId, data)])
 
 char *boolToStr(bool b) {
     if(b) return "true";
@@ -106,9 +357,9 @@ void rladd(replaceList *list, size_t offset) {
         return;
     }
 
-    size_t *noffsets = Malloc((list->cap * 2 + 1) * sizeof(size_t));
+    size_t *noffsets = termAlloc((list->cap * 2 + 1) * sizeof(size_t));
     memcpy(noffsets, list->offsets, list->len * sizeof(size_t));
-    Free(list->offsets);
+    termFree(list->offsets);
     list->offsets = noffsets;
     list->cap = list->cap * 2 + 1;
 
@@ -122,17 +373,112 @@ void rladd(replaceList *list, size_t offset) {
 // }
 
 void rlfree(replaceList list) {
-    Free(list.offsets);
+    termFree(list.offsets);
 }
 
 #define rlinit (128)
-#define mkrl() ((replaceList){ .offsets = Malloc(rlinit * sizeof(size_t)), .len = 0, .cap = rlinit })
+#define mkrl() ((replaceList){ .offsets = termAlloc(rlinit * sizeof(size_t)), .len = 0, .cap = rlinit })
+
+// ==================
+// STATISTICS
+// ==================
+
+// Counters kept by the evaluators while evaluate() runs. They are always on,
+// a few additions per step. Afterwards they are in lastStats, and added to
+// totalStats until the next resetStats(). The time split needs a few clock
+// reads per step, which costs about a third of the demo's run time, so it is
+// only taken while statsTiming is set. renameNs is the part of a rewrite spent
+// copying and renaming arguments and shared terms, spliceNs the rest of it
+// (the de Bruijn strategy has no renaming, its shifts count as splicing)
+typedef struct {
+    int64_t betaSteps;
+    int64_t impureCalls;
+    int64_t sharedCopies;
+    int64_t scanPasses;
+    int64_t bytesScanned;
+    int64_t bytesMoved;
+    size_t peakLen;
+    int64_t scanNs;
+    int64_t renameNs;
+    int64_t spliceNs;
+} evalStats;
+
+bool statsTiming = false;
+
+_Thread_local evalStats runStats = {0};
+_Thread_local evalStats lastStats = {0};
+_Thread_local evalStats totalStats = {0};
+
+static inline int64_t nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+#define statsClock() (statsTiming ? nowNs() : 0)
+
+void addStats(evalStats *to, evalStats from) {
+    to->betaSteps += from.betaSteps;
+    to->impureCalls += from.impureCalls;
+    to->sharedCopies += from.sharedCopies;
+    to->scanPasses += from.scanPasses;
+    to->bytesScanned += from.bytesScanned;
+    to->bytesMoved += from.bytesMoved;
+    if(from.peakLen > to->peakLen) to->peakLen = from.peakLen;
+    to->scanNs += from.scanNs;
+    to->renameNs += from.renameNs;
+    to->spliceNs += from.spliceNs;
+}
+
+void resetStats() {
+    lastStats = (evalStats){0};
+    totalStats = (evalStats){0};
+}
+
+void printStats(evalStats s) {
+    printf("STEPS: %ld beta; %ld impure; %ld shared copies\n", s.betaSteps, s.impureCalls, s.sharedCopies);
+    printf("SCANS: %ld; %ld bytes scanned; %ld bytes moved; PEAK LENGTH: %lu\n", s.scanPasses, s.bytesScanned, s.bytesMoved, s.peakLen);
+    printf("TIME: %.3f ms scan; %.3f ms rename; %.3f ms splice\n", s.scanNs / 1e6, s.renameNs / 1e6, s.spliceNs / 1e6);
+}
 
 // ==================
 // EVALUATION
 // ==================
 
+// Optional side index holding the byte length of the subtree that starts at
+// every node of the term under evaluation. While it is active getExprLen on
+// that term is a lookup; evaluate's rewrite keeps it up to date. It costs 4
+// bytes per term byte, copied on every step along with the term, so it only
+// pays off when the scan measures much more than the rewrite copies
+typedef struct {
+    byte *base;
+    size_t len;
+    uint32_t *lens;
+    uint32_t *occs;
+} lenIndex;
+
+bool useLenIndex = false;
+_Thread_local lenIndex *activeLenIndex = NULL;
+
+// Keeps an occurrence index next to the length index (which it turns on): for
+// every EXPR_FUN the offset to the first occurrence of its variable, for every
+// EXPR_BIND the offset to the next occurrence of the same one, 0 for none. A
+// substitution then follows the links from the lambda instead of walking its
+// body. The links are relative, so subtrees copied by the rewrite along with
+// their slice of the index keep the ones inside them. A lambda above a
+// rewrite is marked OCC_DIRTY instead of being linked up again, its chain can
+// run through every copy of the argument; normal order hardly ever comes back
+// to contract it, and if it does its body is walked as before
+bool useOccIndex = false;
+
+#define OCC_DIRTY UINT32_MAX
+
 size_t getExprLen(byte *data) {
+    lenIndex *index = activeLenIndex;
+    if(index != NULL && data >= index->base && data < index->base + index->len) {
+        return index->lens[data - index->base];
+    }
+
     size_t acc = 0;
     ssize_t depth = 1;
 
@@ -141,16 +487,15 @@ size_t getExprLen(byte *data) {
 
         if(false) {}
         else if(isBind(type)) {
-            acc += sizeof(bindt);
-            data += sizeof(bindt);
+            acc += BIND_LEN;
+            data += BIND_LEN;
 
             depth--;
             continue;
         }
         else if(type == EXPR_FUN) {
-            size_t fun = sizeof(exprType) + sizeof(bindt);
-            data += fun;
-            acc += fun;
+            data += FUN_LEN;
+            acc += FUN_LEN;
 
             depth += 1;
             depth--;
@@ -166,18 +511,23 @@ size_t getExprLen(byte *data) {
             continue;
         }
         else if(type == EXPR_IMPURE_VAL) {
-            size_t ival = sizeof(exprType);
+            size_t ival = impureValLen(data);
             data += ival;
-            size_t vlen = *(size_t *)data;
-            data += sizeof(size_t) + vlen;
-            acc += ival + sizeof(size_t) + vlen;
+            acc += ival;
 
             depth--;
             continue;
         }
         else if(type == EXPR_IMPURE_FUN) {
-            data += sizeof(exprType) + sizeof(impureFunpt);
-            acc += sizeof(exprType) + sizeof(impureFunpt);
+            data += IMPURE_FUN_LEN;
+            acc += IMPURE_FUN_LEN;
+
+            depth--;
+            continue;
+        }
+        else if(type == EXPR_REF) {
+            data += REF_LEN;
+            acc += REF_LEN;
 
             depth--;
             continue;
@@ -188,10 +538,195 @@ size_t getExprLen(byte *data) {
         }
     }
 
+    runStats.bytesScanned += acc;
     return acc;
 }
 
+typedef struct {
+    size_t pos;
+    size_t npos;
+    size_t kind;
+} indexFrame;
+
+typedef struct {
+    indexFrame *items;
+    size_t len;
+    size_t cap;
+} indexStack;
+
+static inline void ixpush(indexStack *stack, indexFrame frame) {
+    if(stack->len == stack->cap) {
+        indexFrame *nitems = termAlloc((stack->cap * 2 + 1) * sizeof(indexFrame));
+        memcpy(nitems, stack->items, stack->len * sizeof(indexFrame));
+        termFree(stack->items);
+        stack->items = nitems;
+        stack->cap = stack->cap * 2 + 1;
+    }
+
+    stack->items[stack->len] = frame;
+    (stack->len)++;
+}
+
+void ixfree(indexStack stack) {
+    termFree(stack.items);
+}
+
+#define ixinit (64)
+#define mkix() ((indexStack){ .items = termAlloc(ixinit * sizeof(indexFrame)), .len = 0, .cap = ixinit })
+
+// Fills `lens` for the term in one pass. Open FUN/APP nodes wait on a stack
+// with the number of children still missing (kept in `kind`)
+void buildLenIndex(byte *odata, size_t len, uint32_t *lens, indexStack *stack) {
+    size_t bottom = stack->len;
+    byte *data = odata;
+
+    while((size_t)(data - odata) < len) {
+        exprType type = *(exprType *)data;
+        size_t pos = data - odata;
+
+        if(false) {}
+        else if(isBind(type)) {
+            data += BIND_LEN;
+        }
+        else if(type == EXPR_FUN) {
+            data += FUN_LEN;
+            ixpush(stack, (indexFrame){ .pos = pos, .kind = 1 });
+            continue;
+        }
+        else if(type == EXPR_APP) {
+            data += sizeof(exprType);
+            ixpush(stack, (indexFrame){ .pos = pos, .kind = 2 });
+            continue;
+        }
+        else if(type == EXPR_IMPURE_VAL) {
+            data += impureValLen(data);
+        }
+        else if(type == EXPR_IMPURE_FUN) {
+            data += IMPURE_FUN_LEN;
+        }
+        else if(type == EXPR_REF) {
+            data += REF_LEN;
+        }
+
+        size_t end = data - odata;
+        lens[pos] = end - pos;
+
+        while(stack->len > bottom) {
+            indexFrame *top = &stack->items[stack->len - 1];
+            if(--(top->kind) > 0) break;
+
+            lens[top->pos] = end - top->pos;
+            stack->len--;
+        }
+    }
+}
+
+typedef struct {
+    bindt bind;
+    ssize_t depth;
+    size_t last;
+    size_t next;
+} occFrame;
+
+typedef struct {
+    occFrame *items;
+    size_t len;
+    size_t cap;
+} occStack;
+
+static inline void ocpush(occStack *stack, occFrame frame) {
+    if(stack->len == stack->cap) {
+        occFrame *nitems = termAlloc((stack->cap * 2 + 1) * sizeof(occFrame));
+        memcpy(nitems, stack->items, stack->len * sizeof(occFrame));
+        termFree(stack->items);
+        stack->items = nitems;
+        stack->cap = stack->cap * 2 + 1;
+    }
+
+    stack->items[stack->len] = frame;
+    (stack->len)++;
+}
+
+void ocfree(occStack stack) {
+    termFree(stack.items);
+}
+
+#define ocinit (16)
+#define mkoc() ((occStack){ .items = termAlloc(ocinit * sizeof(occFrame)), .len = 0, .cap = ocinit })
+
+#define occNext(occs, pos) ((occs)[pos] != 0 ? (pos) + (occs)[pos] : SIZE_MAX)
+
+// Fills `occs` for the term at `data` in one pass. Every lambda in scope
+// waits on the stack with the last node of its chain (`last`) and the depth
+// its scope ends below
+void buildOccIndex(byte *data, uint32_t *occs, occStack *stack) {
+    size_t bottom = stack->len;
+    byte *odata = data;
+    ssize_t depth = 1;
+
+    while(depth > 0) {
+        exprType type = *(exprType *)data;
+        size_t pos = data - odata;
+        while(stack->len > bottom && stack->items[stack->len - 1].depth > depth) stack->len--;
+
+        if(false) {}
+        else if(isBind(type)) {
+            bindt bind = readField(bindt, data + sizeof(exprType));
+            occs[pos] = 0;
+            for(size_t i = stack->len; i > bottom; i--) {
+                occFrame *f = &stack->items[i - 1];
+                if(f->bind == bind) {
+                    occs[f->last] = pos - f->last;
+                    f->last = pos;
+                    break;
+                }
+            }
+            data += BIND_LEN;
+
+            depth--;
+            continue;
+        }
+        else if(type == EXPR_FUN) {
+            occs[pos] = 0;
+            ocpush(stack, (occFrame){ .bind = readField(bindt, data + sizeof(exprType)), .depth = depth, .last = pos });
+            data += FUN_LEN;
+
+            depth += 1;
+            depth--;
+            continue;
+        }
+        else if(type == EXPR_APP) {
+            data += sizeof(exprType);
+
+            depth += 2;
+            depth--;
+            continue;
+        }
+        else if(type == EXPR_IMPURE_VAL) {
+            data += impureValLen(data);
+
+            depth--;
+            continue;
+        }
+        else if(type == EXPR_IMPURE_FUN) {
+            data += IMPURE_FUN_LEN;
+
+            depth--;
+            continue;
+        }
+        else if(type == EXPR_REF) {
+            data += REF_LEN;
+
+            depth--;
+            continue;
+        }
+    }
+
+    stack->len = bottom;
+}
+
 void searchBinds(bindt bind, byte *odata, byte **data, replaceList *list) {
+    byte *start = *data;
     ssize_t depth = 1;
 
     while(depth > 0) {
@@ -199,20 +734,19 @@ void searchBinds(bindt bind, byte *odata, byte **data, replaceList *list) {
 
         if(false) {}
         else if(isBind(type)) {
-            bindt mbind = *(bindt *)*data;
+            bindt mbind = readField(bindt, *data + sizeof(exprType));
 
             if(mbind == bind) {
                 rladd(list, *data - odata);
             }
 
-            *data += sizeof(bindt);
+            *data += BIND_LEN;
 
             depth--;
             continue;
         }
         else if(type == EXPR_FUN) {
-            *data += sizeof(exprType);
-            *data += sizeof(bindt);
+            *data += FUN_LEN;
 
             depth += 1;
             depth--;
@@ -226,44 +760,121 @@ void searchBinds(bindt bind, byte *odata, byte **data, replaceList *list) {
             continue;
         }
         else if(type == EXPR_IMPURE_VAL) {
-            *data += sizeof(exprType);
-            size_t vlen = *(size_t *)*data;
-            *data += sizeof(size_t);
-            *data += vlen;
+            *data += impureValLen(*data);
 
             depth--;
             continue;
         }
         else if(type == EXPR_IMPURE_FUN) {
-            *data += sizeof(exprType);
-            *data += sizeof(impureFunpt);
+            *data += IMPURE_FUN_LEN;
+
+            depth--;
+            continue;
+        }
+        else if(type == EXPR_REF) {
+            *data += REF_LEN;
 
             depth--;
             continue;
         }
     }
+
+    runStats.bytesScanned += *data - start;
 }
 
-bool scanForSubst(byte *odata, byte **data, replaceList *list, size_t *rpos, size_t *rlen, size_t *fpos, size_t *flen, impureFunpt *imfun) {
-    ssize_t depth = 1;
+// Adds the occurrences of the variable bound by the EXPR_FUN at `fun` to the
+// list, from the occurrence index when it has them for this term
+void findBinds(byte *odata, size_t fun, replaceList *list) {
+    lenIndex *index = activeLenIndex;
+    if(index != NULL && index->occs != NULL && index->base == odata && index->occs[fun] != OCC_DIRTY) {
+        for(size_t pos = fun; index->occs[pos] != 0; ) {
+            pos += index->occs[pos];
+            rladd(list, pos);
+        }
+        return;
+    }
+
+    bindt bind = readField(bindt, odata + fun + sizeof(exprType));
+    byte *sdata = odata + fun + FUN_LEN;
+    searchBinds(bind, odata, &sdata, list);
+}
+
+// Where scanForSubst is in the term, so the next scan doesn't have to start
+// from the root again. `path` holds the APP nodes above `pos`, each with the
+// depth and spine the scan had when it got there. A rewrite only changes the
+// term from its first byte on, and the redex was the first one in pre-order,
+// so everything before it stays free of redexes except its parent, which the
+// new node can turn into one (see scanRewind)
+typedef struct {
+    size_t pos;
+    size_t spine;
+    ssize_t depth;
+} scanFrame;
+
+typedef struct {
+    size_t pos;
+    size_t spine;
+    ssize_t depth;
+    scanFrame *path;
+    size_t len;
+    size_t cap;
+} scanCursor;
+
+static inline void scpush(scanCursor *cur, scanFrame frame) {
+    if(cur->len == cur->cap) {
+        scanFrame *nitems = termAlloc((cur->cap * 2 + 1) * sizeof(scanFrame));
+        memcpy(nitems, cur->path, cur->len * sizeof(scanFrame));
+        termFree(cur->path);
+        cur->path = nitems;
+        cur->cap = cur->cap * 2 + 1;
+    }
+
+    cur->path[cur->len] = frame;
+    (cur->len)++;
+}
+
+void scfree(scanCursor cur) {
+    termFree(cur.path);
+}
+
+#define scinit (64)
+#define mksc() ((scanCursor){ .spine = SIZE_MAX, .depth = 1, .path = termAlloc(scinit * sizeof(scanFrame)), .cap = scinit })
+
+// Besides redexes this stops at the shared terms that have to be copied in
+// first: the ones in function position, and the ones that are not in normal
+// form themselves. Those come back in `shared`, with `fpos` at the EXPR_REF
+// and `spos` at the outermost application of the spine it heads. The scan
+// starts at the cursor and leaves it at the node it stopped on
+bool scanForSubst(byte *odata, scanCursor *cur, replaceList *list, size_t *rpos, size_t *rlen, size_t *fpos, size_t *flen, impureFunpt *imfun, expr *shared, size_t *spos) {
+    byte *at = odata + cur->pos;
+    byte **data = &at;
+    byte *start = *data;
+    ssize_t depth = cur->depth;
     bool result = false;
+    size_t spine = cur->spine;
 
     while(depth > 0) {
-        if(result) return result;
+        if(result) break;
 
         exprType type = *(exprType *)*data;
 
+        while(cur->len > 0 && cur->path[cur->len - 1].depth > depth) cur->len--;
+        cur->pos = *data - odata;
+        cur->depth = depth;
+        cur->spine = spine;
+
+        if(type != EXPR_APP) spine = SIZE_MAX;
+
         if(false) {}
         else if(isBind(type)) {
-            *data += sizeof(exprType);
+            *data += BIND_LEN;
 
             result = false;
             depth--;
             continue;
         }
         else if(type == EXPR_FUN) {
-            *data += sizeof(exprType);
-            *data += sizeof(bindt);
+            *data += FUN_LEN;
 
             depth += 1;
             depth--;
@@ -271,6 +882,8 @@ bool scanForSubst(byte *odata, byte **data, replaceList *list, size_t *rpos, siz
         }
         else if(type == EXPR_APP) {
             *fpos = *data - odata;
+            scpush(cur, (scanFrame){ .pos = *fpos, .spine = spine, .depth = depth });
+            if(spine == SIZE_MAX) spine = *fpos;
             *data += sizeof(exprType);
             exprType lhsType = *(exprType *)*data;
             if(lhsType == EXPR_FUN) {
@@ -279,13 +892,10 @@ bool scanForSubst(byte *odata, byte **data, replaceList *list, size_t *rpos, siz
                 size_t argLen = getExprLen(*data + funLen);
                 *data += sizeof(exprType);
 
-                *flen = sizeof(exprType) + sizeof(exprType) + sizeof(bindt);
-
-                bindt bind = *(bindt *)*data;
+                *flen = sizeof(exprType) + FUN_LEN;
                 *data += sizeof(bindt);
 
-                byte *sdata = *data;
-                searchBinds(bind, odata, &sdata, list);
+                findBinds(odata, *fpos + sizeof(exprType), list);
 
                 *rpos = *fpos + sizeof(exprType) + funLen;
                 *rlen = argLen;
@@ -294,11 +904,9 @@ bool scanForSubst(byte *odata, byte **data, replaceList *list, size_t *rpos, siz
                 continue;
             }
             else if(lhsType == EXPR_IMPURE_FUN) {
-                *data += sizeof(exprType);
-                *imfun = *(impureFunpt *)*data;
-                rladd(list, *data - odata); // NOTE: assumes sizeof(bindt) == sizeof(pointer)
-                *data += sizeof(impureFunpt);
-                *flen = sizeof(exprType) + sizeof(exprType); // + sizeof(impureFunpt);
+                *imfun = impureAt(*data + sizeof(exprType));
+                *data += IMPURE_FUN_LEN;
+                *flen = sizeof(exprType) + IMPURE_FUN_LEN;
 
                 *rpos = *data - odata;
                 *rlen = getExprLen(*data);
@@ -306,7 +914,7 @@ bool scanForSubst(byte *odata, byte **data, replaceList *list, size_t *rpos, siz
                 exprType argType = *(exprType *)*data;
                 if(argType != EXPR_IMPURE_VAL) {
                     *imfun = NULL;
-                    list->len = 0;
+                    spine = SIZE_MAX;
 
                     depth += 1;
                     depth--;
@@ -316,6 +924,17 @@ bool scanForSubst(byte *odata, byte **data, replaceList *list, size_t *rpos, siz
                 result = true;
                 continue;
             }
+            else if(lhsType == EXPR_REF) {
+                *fpos = *data - odata;
+                *flen = 0;
+                *rpos = *fpos;
+                *rlen = REF_LEN;
+                *shared = sharedAt(*data + sizeof(exprType))->term;
+                *spos = spine;
+
+                result = true;
+                continue;
+            }
             else {
                 depth += 2;
                 depth--;
@@ -323,73 +942,194 @@ bool scanForSubst(byte *odata, byte **data, replaceList *list, size_t *rpos, siz
             }
         }
         else if(type == EXPR_IMPURE_VAL) {
-            *data += sizeof(exprType);
-            size_t vlen = *(size_t *)*data;
-            *data += sizeof(size_t);
-            *data += vlen;
+            *data += impureValLen(*data);
 
             result = false;
             depth--;
             continue;
         }
         else if(type == EXPR_IMPURE_FUN) {
-            *data += sizeof(exprType);
-            *data += sizeof(impureFunpt);
+            *data += IMPURE_FUN_LEN;
 
             result = false;
             depth--;
             continue;
         }
-    }
-
-    return result;
-}
-
-void replaceBindings(bindt oldBind, bindt newBind, byte **data) {
-    ssize_t depth = 1;
-    while(depth > 0) {
-        exprType type = *(exprType *)*data;
-
-        if(false) {}
-        else if(isBind(type)) {
-            bindt mbind = *(bindt *)*data;
+        else if(type == EXPR_REF) {
+            sharedTerm *s = sharedAt(*data + sizeof(exprType));
+            if(!s->normal) {
+                *fpos = *data - odata;
+                *flen = 0;
+                *rpos = *fpos;
+                *rlen = REF_LEN;
+                *shared = s->term;
+                *spos = *fpos;
 
-            if(mbind == oldBind) {
-                *(bindt *)*data = newBind;
+                result = true;
+                continue;
             }
 
-            *data += sizeof(bindt);
+            *data += REF_LEN;
 
+            result = false;
             depth--;
             continue;
         }
-        else if(type == EXPR_FUN) {
-            *data += sizeof(exprType);
-            *data += sizeof(bindt);
+    }
 
-            depth += 1;
-            depth--;
-            continue;
+    runStats.scanPasses++;
+    runStats.bytesScanned += *data - start;
+    return result;
+}
+
+// Sets the cursor up for the scan after a rewrite that starts at `fpos`,
+// which is the node the scan stopped on or an APP on its path (a whole spine
+// going to the normal form cache). The scan goes on from the parent if the
+// rewritten node is its function, or the argument of its impure function,
+// and from the rewritten node otherwise
+void scanRewind(scanCursor *cur, byte *odata, size_t fpos) {
+    bool found = cur->pos == fpos;
+    while(cur->len > 0 && cur->path[cur->len - 1].pos >= fpos) {
+        scanFrame *top = &cur->path[--(cur->len)];
+        if(top->pos == fpos) {
+            cur->pos = fpos;
+            cur->spine = top->spine;
+            cur->depth = top->depth;
+            found = true;
+        }
+    }
+
+    if(cur->len > 0) {
+        scanFrame *parent = &cur->path[cur->len - 1];
+        size_t lhs = parent->pos + sizeof(exprType);
+        if(lhs == fpos || (*(exprType *)(odata + lhs) == EXPR_IMPURE_FUN && lhs + IMPURE_FUN_LEN == fpos)) {
+            cur->pos = parent->pos;
+            cur->spine = parent->spine;
+            cur->depth = parent->depth;
+            cur->len--;
+            return;
+        }
+    }
+
+    if(!found) {
+        cur->pos = 0;
+        cur->spine = SIZE_MAX;
+        cur->depth = 1;
+        cur->len = 0;
+    }
+}
+
+// A lambda renamed by makeUniqueBindings, with the depth it was found at
+typedef struct {
+    bindt old;
+    bindt new;
+    ssize_t depth;
+} renameFrame;
+
+_Thread_local renameFrame *renameFrames = NULL;
+_Thread_local size_t renameCap = 0;
+
+#ifdef CHECK_BINDERS
+_Thread_local bindt *uniqueBinds = NULL;
+_Thread_local size_t uniqueCap = 0;
+
+int compareBinds(const void *a, const void *b) {
+    bindt x = *(const bindt *)a;
+    bindt y = *(const bindt *)b;
+    return (x > y) - (x < y);
+}
+
+// Whether no two lambdas in the term have the same binder, which moving an
+// argument without renaming it relies on
+bool bindersUnique(byte *data, size_t len) {
+    size_t count = 0;
+    for(byte *end = data + len; data < end;) {
+        exprType type = *(exprType *)data;
+
+        if(false) {}
+        else if(type == EXPR_FUN) {
+            if(count == uniqueCap) {
+                uniqueCap = uniqueCap * 2 + 16;
+                uniqueBinds = Realloc(uniqueBinds, uniqueCap * sizeof(bindt));
+            }
+            uniqueBinds[count++] = readField(bindt, data + sizeof(exprType));
+            data += FUN_LEN;
+        }
+        else if(type == EXPR_APP)        data += sizeof(exprType);
+        else if(type == EXPR_IMPURE_VAL) data += impureValLen(data);
+        else if(type == EXPR_IMPURE_FUN) data += IMPURE_FUN_LEN;
+        else if(type == EXPR_REF)        data += REF_LEN;
+        else                             data += BIND_LEN;
+    }
+
+    qsort(uniqueBinds, count, sizeof(bindt), compareBinds);
+    for(size_t i = 1; i < count; i++) {
+        if(uniqueBinds[i - 1] == uniqueBinds[i]) return false;
+    }
+    return true;
+}
+#endif
+
+// Gives every lambda in the term a fresh binder, in one pass. A renamed
+// binder is in scope as long as the depth does not drop below the depth of
+// its lambda; variables bound outside the term keep theirs
+void makeUniqueBindings(byte *data) {
+    size_t len = 0;
+    ssize_t depth = 1;
+
+    while(depth > 0) {
+        exprType type = *(exprType *)data;
+        while(len > 0 && renameFrames[len - 1].depth > depth) len--;
+
+        if(false) {}
+        else if(isBind(type)) {
+            bindt bind = readField(bindt, data + sizeof(exprType));
+            for(size_t i = len; i > 0; i--) {
+                if(renameFrames[i - 1].old == bind) {
+                    writeField(bindt, data + sizeof(exprType), renameFrames[i - 1].new);
+                    break;
+                }
+            }
+            data += BIND_LEN;
+
+            depth--;
+            continue;
+        }
+        else if(type == EXPR_FUN) {
+            if(len == renameCap) {
+                renameCap = renameCap * 2 + 16;
+                renameFrames = Realloc(renameFrames, renameCap * sizeof(renameFrame));
+            }
+            var(newBind);
+            renameFrames[len++] = (renameFrame){ .old = readField(bindt, data + sizeof(exprType)), .new = newBind, .depth = depth };
+            writeField(bindt, data + sizeof(exprType), newBind);
+            data += FUN_LEN;
+
+            depth += 1;
+            depth--;
+            continue;
         }
         else if(type == EXPR_APP) {
-            *data += sizeof(exprType);
-            
+            data += sizeof(exprType);
+
             depth += 2;
             depth--;
             continue;
         }
         else if(type == EXPR_IMPURE_VAL) {
-            *data += sizeof(exprType);
-            size_t vlen = *(size_t *)*data;
-            *data += sizeof(size_t);
-            *data += vlen;
+            data += impureValLen(data);
 
             depth--;
             continue;
         }
         else if(type == EXPR_IMPURE_FUN) {
-            *data += sizeof(exprType);
-            *data += sizeof(impureFunpt);
+            data += IMPURE_FUN_LEN;
+
+            depth--;
+            continue;
+        }
+        else if(type == EXPR_REF) {
+            data += REF_LEN;
 
             depth--;
             continue;
@@ -397,121 +1137,4804 @@ void replaceBindings(bindt oldBind, bindt newBind, byte **data) {
     }
 }
 
-void makeUniqueBindings(byte *data) {
-    ssize_t depth = 1;
+// A redex is rewritten as a whole, from its EXPR_APP node at `fpos` up to
+// `end`. Pure redexes have their body at `bpos` and the occurrences of the
+// bound variable in a replaceList; impure ones carry the function instead.
+// A shared redex is just an EXPR_REF, replaced by a renamed copy of `result`
+typedef struct {
+    size_t fpos;
+    size_t end;
+    size_t bpos;
+    size_t rpos;
+    size_t rlen;
+    size_t occFirst;
+    size_t occLen;
+    impureFunpt imfun;
+    bool shared;
+    expr result;
+} redex;
+
+typedef struct {
+    redex *items;
+    size_t len;
+    size_t cap;
+} redexList;
+
+void rdxadd(redexList *list, redex r) {
+    if(list->len < list->cap) {
+        list->items[list->len] = r;
+        (list->len)++;
+        return;
+    }
+
+    redex *nitems = termAlloc((list->cap * 2 + 1) * sizeof(redex));
+    memcpy(nitems, list->items, list->len * sizeof(redex));
+    termFree(list->items);
+    list->items = nitems;
+    list->cap = list->cap * 2 + 1;
+
+    rdxadd(list, r);
+}
+
+void rdxfree(redexList list) {
+    termFree(list.items);
+}
+
+#define rdxinit (32)
+#define mkrdx() ((redexList){ .items = termAlloc(rdxinit * sizeof(redex)), .len = 0, .cap = rdxinit })
+
+// The spare half of a double buffer: a rewrite streams the term into it and
+// then the two are swapped, so no step has to memmove or Realloc the term.
+// The length and occurrence indexes, when used, are double buffered the same
+// way
+typedef struct {
+    byte *spare;
+    size_t spareCap;
+    size_t cap;
+
+    uint32_t *lens;
+    uint32_t *spareLens;
+    size_t lensCap;
+    size_t spareLensCap;
+    lenIndex index;
+    lenIndex *prevIndex;
+    indexStack stack;
+
+    uint32_t *occs;
+    uint32_t *spareOccs;
+    size_t occsCap;
+    size_t spareOccsCap;
+    occStack open;
+} rewriteBuffers;
+
+void rwbinit(rewriteBuffers *buffers, expr *e) {
+    *buffers = (rewriteBuffers){ .cap = e->len };
+    buffers->prevIndex = activeLenIndex;
+
+    if(useLenIndex || useOccIndex) {
+        buffers->lens = termAlloc(e->len * sizeof(uint32_t));
+        buffers->lensCap = e->len;
+        buffers->index = (lenIndex){ .base = e->data, .len = e->len, .lens = buffers->lens };
+        buffers->stack = mkix();
+        buildLenIndex(e->data, e->len, buffers->lens, &buffers->stack);
+        activeLenIndex = &buffers->index;
+    }
+
+    if(useOccIndex) {
+        buffers->occs = termAlloc(e->len * sizeof(uint32_t));
+        buffers->occsCap = e->len;
+        buffers->index.occs = buffers->occs;
+        buffers->open = mkoc();
+        buildOccIndex(e->data, buffers->occs, &buffers->open);
+    }
+}
+
+void rwbfree(rewriteBuffers *buffers) {
+    activeLenIndex = buffers->prevIndex;
+    termFree(buffers->spare);
+    termFree(buffers->lens);
+    termFree(buffers->spareLens);
+    if(buffers->lens != NULL) ixfree(buffers->stack);
+    termFree(buffers->occs);
+    termFree(buffers->spareOccs);
+    if(buffers->occs != NULL) ocfree(buffers->open);
+}
+
+#define EMIT_TERM 0
+#define EMIT_BODY 1
+#define EMIT_CLOSE 2
+
+// Links the occurrences of the open lambdas that lie in the old range
+// [pos, pos + len), now copied to `at`
+static inline void occThread(occStack *open, uint32_t *oocc, uint32_t *nocc, size_t pos, size_t len, size_t at) {
+    for(size_t i = 0; i < open->len; i++) {
+        occFrame *f = &open->items[i];
+        while(f->next < pos + len) {
+            size_t npos = at + (f->next - pos);
+            nocc[f->last] = npos - f->last;
+            f->last = npos;
+            f->next = occNext(oocc, f->next);
+        }
+    }
+}
+
+// Indexed version of rewriteSegments. Subtrees that contain no
+// redex (or, inside a body, no occurrence) are copied together with their
+// slice of the index; only the nodes above a splice are visited one by one,
+// and their lengths are filled in once their children are done.
+// With `nocc` set the occurrence index is carried along too. The lambdas
+// visited inside a body wait in `open`, and their chains are linked up again
+// occurrence by occurrence from the old links; the ones visited above a redex
+// are marked OCC_DIRTY, and so are the copies of dirty ones
+size_t emitIndexed(byte *odata, uint32_t *olens, byte *ndata, uint32_t *nlens, redexList *redexes, replaceList *list, indexStack *stack, uint32_t *oocc, uint32_t *nocc, occStack *open) {
+    ixpush(stack, (indexFrame){ .pos = 0, .kind = EMIT_TERM });
+
+    size_t cur = 0;
+    size_t next = 0;
+
+    redex *r = NULL;
+    size_t occ = 0;
+    size_t occEnd = 0;
+
+    while(stack->len > 0) {
+        indexFrame frame = stack->items[--stack->len];
+
+        if(frame.kind == EMIT_CLOSE) {
+            nlens[frame.npos] = cur - frame.npos;
+            if(nocc != NULL && *(exprType *)(ndata + frame.npos) == EXPR_FUN && nocc[frame.npos] != OCC_DIRTY) {
+                occFrame *f = &open->items[--(open->len)];
+                nocc[f->last] = 0;
+            }
+            continue;
+        }
+
+        size_t pos = frame.pos;
+        size_t len = olens[pos];
+
+        size_t site = SIZE_MAX;
+        if(frame.kind == EMIT_TERM && next < redexes->len) site = redexes->items[next].fpos;
+        if(frame.kind == EMIT_BODY && occ < occEnd) site = list->offsets[occ];
+
+        if(site >= pos + len) {
+            memcpy(ndata + cur, odata + pos, len);
+            memcpy(nlens + cur, olens + pos, len * sizeof(uint32_t));
+            if(nocc != NULL) {
+                memcpy(nocc + cur, oocc + pos, len * sizeof(uint32_t));
+                occThread(open, oocc, nocc, pos, len, cur);
+            }
+            cur += len;
+            continue;
+        }
+
+        if(site == pos && frame.kind == EMIT_TERM) {
+            r = &redexes->items[next++];
+
+            if(r->imfun != NULL || r->shared) {
+                int64_t renameStarted = statsClock();
+                memcpy(ndata + cur, r->result.data, r->result.len);
+                buildLenIndex(ndata + cur, r->result.len, nlens + cur, stack);
+                if(nocc != NULL) buildOccIndex(ndata + cur, nocc + cur, open);
+                if(r->shared) makeUniqueBindings(ndata + cur);
+                else          termFree(r->result.data);
+                cur += r->result.len;
+                runStats.renameNs += statsClock() - renameStarted;
+                continue;
+            }
+
+            occ = r->occFirst;
+            occEnd = r->occFirst + r->occLen;
+            ixpush(stack, (indexFrame){ .pos = r->bpos, .kind = EMIT_BODY });
+            continue;
+        }
+
+        if(site == pos && frame.kind == EMIT_BODY) {
+            occ++;
+
+            memcpy(ndata + cur, odata + r->rpos, r->rlen);
+            memcpy(nlens + cur, olens + r->rpos, r->rlen * sizeof(uint32_t));
+            if(nocc != NULL) memcpy(nocc + cur, oocc + r->rpos, r->rlen * sizeof(uint32_t));
+            if(occ < occEnd) {
+                int64_t renameStarted = statsClock();
+                makeUniqueBindings(ndata + cur);
+                runStats.renameNs += statsClock() - renameStarted;
+            }
+            cur += r->rlen;
+            continue;
+        }
+
+        exprType type = *(exprType *)(odata + pos);
+        ixpush(stack, (indexFrame){ .npos = cur, .kind = EMIT_CLOSE });
+
+        if(type == EXPR_APP) {
+            *(exprType *)(ndata + cur) = EXPR_APP;
+            cur += sizeof(exprType);
+
+            size_t lhs = pos + sizeof(exprType);
+            ixpush(stack, (indexFrame){ .pos = lhs + olens[lhs], .kind = frame.kind });
+            ixpush(stack, (indexFrame){ .pos = lhs, .kind = frame.kind });
+        }
+        else {
+            memcpy(ndata + cur, odata + pos, FUN_LEN);
+            if(nocc != NULL && (frame.kind == EMIT_TERM || oocc[pos] == OCC_DIRTY)) {
+                nocc[cur] = OCC_DIRTY;
+            }
+            else if(nocc != NULL) {
+                nocc[cur] = 0;
+                ocpush(open, (occFrame){ .next = occNext(oocc, pos), .last = cur });
+            }
+            cur += FUN_LEN;
+
+            ixpush(stack, (indexFrame){ .pos = pos + FUN_LEN, .kind = frame.kind });
+        }
+    }
+
+    return cur;
+}
+
+// Copies the term into `ndata` in one left-to-right pass, contracting every
+// redex in `redexes` on the way. An argument whose variable is not used is
+// never copied, and the last occurrence gets it as it is, since the original
+// goes away. Only the copies for the other occurrences get fresh binders, so
+// every binder stays unique in the term and a moved argument can't capture
+// anything
+void rewriteSegments(byte *odata, size_t len, byte *ndata, redexList *redexes, replaceList *list) {
+    byte *data = ndata;
+    size_t last = 0;
+
+    for(size_t i = 0; i < redexes->len; i++) {
+        redex *r = &redexes->items[i];
+
+        memcpy(data, odata + last, r->fpos - last);
+        data += r->fpos - last;
+        last = r->end;
+
+        if(r->imfun != NULL || r->shared) {
+            int64_t renameStarted = statsClock();
+            memcpy(data, r->result.data, r->result.len);
+            if(r->shared) makeUniqueBindings(data);
+            else          termFree(r->result.data);
+            data += r->result.len;
+            runStats.renameNs += statsClock() - renameStarted;
+            continue;
+        }
+
+        size_t from = r->bpos;
+        for(size_t j = 0; j < r->occLen; j++) {
+            size_t offset = list->offsets[r->occFirst + j];
+
+            memcpy(data, odata + from, offset - from);
+            data += offset - from;
+            from = offset + BIND_LEN;
+
+            memcpy(data, odata + r->rpos, r->rlen);
+            if(j + 1 < r->occLen) {
+                int64_t renameStarted = statsClock();
+                makeUniqueBindings(data);
+                runStats.renameNs += statsClock() - renameStarted;
+            }
+            data += r->rlen;
+        }
+
+        memcpy(data, odata + from, r->rpos - from);
+        data += r->rpos - from;
+    }
+
+    memcpy(data, odata + last, len - last);
+}
+
+// Computes the impure results and the new length, then streams the term into
+// the spare buffer (through emitIndexed when the length index is on) and
+// swaps the buffers
+void rewriteRedexes(expr *e, redexList *redexes, replaceList *list, rewriteBuffers *buffers) {
+    int64_t started = statsClock();
+    int64_t renamed = runStats.renameNs;
+    byte *odata = e->data;
+
+    size_t newLen = e->len;
+    for(size_t i = 0; i < redexes->len; i++) {
+        redex *r = &redexes->items[i];
+        if(r->imfun != NULL) {
+            r->result = r->imfun(odata + r->rpos, r->rlen);
+        }
+
+        if(r->imfun != NULL || r->shared) {
+            newLen = newLen - (r->end - r->fpos) + r->result.len;
+        }
+        else {
+            size_t blen = r->rpos - r->bpos;
+            newLen = newLen - (r->end - r->fpos) + blen + r->occLen * (r->rlen - BIND_LEN);
+        }
+    }
+
+    for(size_t i = 0; i < redexes->len; i++) {
+        redex *r = &redexes->items[i];
+        if(false) {}
+        else if(r->imfun != NULL) runStats.impureCalls++;
+        else if(r->shared)        runStats.sharedCopies++;
+        else                      runStats.betaSteps++;
+    }
+    runStats.bytesMoved += newLen;
+    if(buffers->lens != NULL) runStats.bytesMoved += newLen * sizeof(uint32_t);
+    if(buffers->occs != NULL) runStats.bytesMoved += newLen * sizeof(uint32_t);
+    if(newLen > runStats.peakLen) runStats.peakLen = newLen;
+
+    if(buffers->spareCap < newLen) {
+        size_t ncap = buffers->spareCap * 2;
+        if(ncap < newLen) ncap = newLen;
+
+        termFree(buffers->spare);
+        buffers->spare = termAlloc(ncap);
+        buffers->spareCap = ncap;
+    }
+
+    byte *ndata = buffers->spare;
+
+    if(buffers->lens != NULL) {
+        if(buffers->spareLensCap < newLen) {
+            size_t ncap = buffers->spareLensCap * 2;
+            if(ncap < newLen) ncap = newLen;
+
+            termFree(buffers->spareLens);
+            buffers->spareLens = termAlloc(ncap * sizeof(uint32_t));
+            buffers->spareLensCap = ncap;
+        }
+
+        if(buffers->occs != NULL && buffers->spareOccsCap < newLen) {
+            size_t ncap = buffers->spareOccsCap * 2;
+            if(ncap < newLen) ncap = newLen;
+
+            termFree(buffers->spareOccs);
+            buffers->spareOccs = termAlloc(ncap * sizeof(uint32_t));
+            buffers->spareOccsCap = ncap;
+        }
+
+        emitIndexed(odata, buffers->lens, ndata, buffers->spareLens, redexes, list, &buffers->stack, buffers->occs, buffers->spareOccs, &buffers->open);
+
+        uint32_t *nlens = buffers->spareLens;
+        size_t ncap = buffers->spareLensCap;
+        buffers->spareLens = buffers->lens;
+        buffers->spareLensCap = buffers->lensCap;
+        buffers->lens = nlens;
+        buffers->lensCap = ncap;
+
+        uint32_t *noccs = buffers->spareOccs;
+        ncap = buffers->spareOccsCap;
+        buffers->spareOccs = buffers->occs;
+        buffers->spareOccsCap = buffers->occsCap;
+        buffers->occs = noccs;
+        buffers->occsCap = ncap;
+
+        buffers->index = (lenIndex){ .base = ndata, .len = newLen, .lens = nlens, .occs = noccs };
+    }
+    else {
+        rewriteSegments(odata, e->len, ndata, redexes, list);
+    }
+#ifdef CHECK_BINDERS
+    // Binders are 64 bit and never reused, so this only fails if a term was
+    // built with duplicate binders or a copy missed its renaming
+    if(!bindersUnique(ndata, newLen)) {
+        printf("Two lambdas share a binder after a rewrite\n");
+        exit(1);
+    }
+#endif
+
+    size_t ncap = buffers->spareCap;
+    buffers->spare = e->data;
+    buffers->spareCap = buffers->cap;
+    buffers->cap = ncap;
+
+    e->data = ndata;
+    e->len = newLen;
+
+    runStats.spliceNs += statsClock() - started - (runStats.renameNs - renamed);
+}
+
+// Budget for the rewriting strategies, set by evalRun (see STRATEGIES).
+// Before each step they check fuelLeft and stop early once runStats has
+// counted fuelSteps steps or the clock has passed fuelDeadline; the term is
+// whole after every step, so it can be picked up again later. The clock is
+// only read every 16 checks. fuelSteps -1 and fuelDeadline 0 mean no limit
+_Thread_local int64_t fuelSteps = -1;
+_Thread_local int64_t fuelDeadline = 0;
+_Thread_local uint32_t fuelChecks = 0;
+_Thread_local bool fuelExhausted = false;
+
+static inline bool fuelLeft() {
+    if(fuelSteps < 0 && fuelDeadline == 0) return true;
+
+    int64_t steps = runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies;
+    if(fuelSteps >= 0 && steps >= fuelSteps) fuelExhausted = true;
+    if(fuelDeadline > 0 && (fuelChecks++ & 15) == 0 && nowNs() >= fuelDeadline) fuelExhausted = true;
+    return !fuelExhausted;
+}
+
+// See NORMAL FORM CACHE
+bool useNormalCache = false;
+void memoSpine(expr *e, size_t spos, redex *r);
+
+void evaluateSingle(expr *e) {
+    replaceList list = mkrl();
+    redexList redexes = mkrdx();
+    rewriteBuffers buffers;
+    rwbinit(&buffers, e);
+
+    scanCursor cur = mksc();
+
+    size_t rpos;
+    size_t rlen;
+
+    size_t fpos;
+    size_t flen;
+
+    impureFunpt imfun = NULL;
+    expr shared = {0};
+    size_t spos;
+
+    int64_t scanStarted = statsClock();
+    while(fuelLeft() && scanForSubst(e->data, &cur, &list, &rpos, &rlen, &fpos, &flen, &imfun, &shared, &spos)) {
+        runStats.scanNs += statsClock() - scanStarted;
+
+        redex r = {
+            .fpos = fpos,
+            .end = rpos + rlen,
+            .bpos = fpos + flen,
+            .rpos = rpos,
+            .rlen = rlen,
+            .occFirst = 0,
+            .occLen = list.len,
+            .imfun = imfun,
+            .shared = shared.data != NULL,
+            .result = shared,
+        };
+        if(useNormalCache && r.shared && spos < fpos) memoSpine(e, spos, &r);
+        rdxadd(&redexes, r);
+
+        rewriteRedexes(e, &redexes, &list, &buffers);
+        scanRewind(&cur, e->data, r.fpos);
+
+        redexes.len = 0;
+        list.len = 0;
+        imfun = NULL;
+        shared = (expr){0};
+        scanStarted = statsClock();
+    }
+    runStats.scanNs += statsClock() - scanStarted;
+
+    scfree(cur);
+    rwbfree(&buffers);
+    rdxfree(redexes);
+    rlfree(list);
+}
+
+// ==================
+// DE BRUIJN
+// ==================
+
+// Alternative encoding used by EVAL_DEBRUIJN. EXPR_FUN is just the tag, and a
+// variable holds its de Bruijn index where the binder would be. Substitution
+// shifts indices instead of renaming binders: the term is converted once,
+// reduced in this form and converted back with fresh binders
+
+#define dbIndex(data) readField(bindt, (data) + sizeof(exprType))
+
+// Depth stack for the pre-order walks below: every pending subtree remembers
+// how many binders are above it
+typedef struct {
+    size_t *items;
+    size_t len;
+    size_t cap;
+} depthStack;
+
+static inline void dspush(depthStack *stack, size_t depth) {
+    if(stack->len == stack->cap) {
+        size_t *nitems = termAlloc((stack->cap * 2 + 1) * sizeof(size_t));
+        memcpy(nitems, stack->items, stack->len * sizeof(size_t));
+        termFree(stack->items);
+        stack->items = nitems;
+        stack->cap = stack->cap * 2 + 1;
+    }
+
+    stack->items[stack->len] = depth;
+    (stack->len)++;
+}
+
+void dsfree(depthStack stack) {
+    termFree(stack.items);
+}
+
+#define dsinit (64)
+#define mkds() ((depthStack){ .items = termAlloc(dsinit * sizeof(size_t)), .len = 0, .cap = dsinit })
+
+// Free variables of an open term, in order of first occurrence. In de Bruijn
+// form the i-th one is index depth + i
+typedef struct {
+    bindt *items;
+    size_t len;
+    size_t cap;
+} bindList;
+
+void blpush(bindList *list, bindt bind) {
+    if(list->len == list->cap) {
+        bindt *nitems = termAlloc((list->cap * 2 + 1) * sizeof(bindt));
+        memcpy(nitems, list->items, list->len * sizeof(bindt));
+        termFree(list->items);
+        list->items = nitems;
+        list->cap = list->cap * 2 + 1;
+    }
+
+    list->items[list->len] = bind;
+    (list->len)++;
+}
+
+void blfree(bindList list) {
+    termFree(list.items);
+}
+
+#define blinit (16)
+#define mkbl() ((bindList){ .items = termAlloc(blinit * sizeof(bindt)), .len = 0, .cap = blinit })
+
+// Length of the node itself, without its children
+size_t dbNodeLen(byte *data) {
+    exprType type = *(exprType *)data;
+    if(type == EXPR_IMPURE_VAL) return impureValLen(data);
+    if(type == EXPR_IMPURE_FUN) return IMPURE_FUN_LEN;
+    if(type == EXPR_REF) return REF_LEN;
+    if(isBind(type)) return BIND_LEN;
+    return sizeof(exprType);
+}
+
+size_t dbChildren(exprType type) {
+    if(type == EXPR_APP) return 2;
+    if(type == EXPR_FUN) return 1;
+    return 0;
+}
+
+size_t getDbLen(byte *data) {
+    size_t acc = 0;
+    ssize_t depth = 1;
+
+    while(depth > 0) {
+        size_t len = dbNodeLen(data);
+        depth += dbChildren(*(exprType *)data);
+        data += len;
+        acc += len;
+        depth--;
+    }
+
+    runStats.bytesScanned += acc;
+    return acc;
+}
+
+// Same as buildLenIndex, for a de Bruijn form
+void dbBuildLenIndex(byte *odata, size_t len, uint32_t *lens, indexStack *stack) {
+    size_t bottom = stack->len;
+    byte *data = odata;
+
+    while((size_t)(data - odata) < len) {
+        exprType type = *(exprType *)data;
+        size_t pos = data - odata;
+        data += dbNodeLen(data);
+
+        if(dbChildren(type) > 0) {
+            ixpush(stack, (indexFrame){ .pos = pos, .kind = dbChildren(type) });
+            continue;
+        }
+
+        size_t end = data - odata;
+        lens[pos] = end - pos;
+
+        while(stack->len > bottom) {
+            indexFrame *top = &stack->items[stack->len - 1];
+            if(--(top->kind) > 0) break;
+
+            lens[top->pos] = end - top->pos;
+            stack->len--;
+        }
+    }
+}
+
+// Writes the de Bruijn form of `e` to `ndata` (at most e.len bytes) and
+// returns its length; `binds` needs room for one entry per FUN_LEN bytes.
+// Free variables are numbered through `free` when it is given. Otherwise they
+// are fatal unless `closed` is given, then they are only reported there and
+// the result is meaningless
+size_t deBruijnInto(expr e, byte *ndata, bindt *binds, depthStack *stack, bool *closed, bindList *free) {
+    size_t bottom = stack->len;
+    dspush(stack, 0);
+
+    byte *data = e.data;
+    byte *out = ndata;
+
+    while(stack->len > bottom) {
+        size_t depth = stack->items[--stack->len];
+        exprType type = *(exprType *)data;
+
+        if(false) {}
+        else if(isBind(type)) {
+            bindt bind = readField(bindt, data + sizeof(exprType));
+            size_t i = depth;
+            while(i > 0 && binds[i - 1] != bind) i--;
+            size_t index = depth - i;
+
+            if(i == 0 && free != NULL) {
+                size_t j = 0;
+                while(j < free->len && free->items[j] != bind) j++;
+                if(j == free->len) blpush(free, bind);
+                index = depth + j;
+            }
+            else if(i == 0) {
+                if(closed == NULL) {
+                    printf("Free variable %lu can't be converted to de Bruijn form\n", bind);
+                    exit(1);
+                }
+                *closed = false;
+            }
+
+            *(exprType *)out = EXPR_BIND;
+            writeField(bindt, out + sizeof(exprType), index);
+            out += BIND_LEN;
+            data += BIND_LEN;
+        }
+        else if(type == EXPR_FUN) {
+            binds[depth] = readField(bindt, data + sizeof(exprType));
+            *(exprType *)out = EXPR_FUN;
+            out += sizeof(exprType);
+            data += FUN_LEN;
+
+            dspush(stack, depth + 1);
+        }
+        else {
+            size_t len = dbNodeLen(data);
+            memcpy(out, data, len);
+            out += len;
+            data += len;
+
+            for(size_t i = 0; i < dbChildren(type); i++) dspush(stack, depth);
+        }
+    }
+
+    return out - ndata;
+}
+
+expr toDeBruijn(expr e, bool *closed) {
+    depthStack stack = mkds();
+    bindt *binds = termAlloc((e.len / FUN_LEN + 1) * sizeof(bindt));
+    byte *ndata = termAlloc(e.len);
+
+    size_t len = deBruijnInto(e, ndata, binds, &stack, closed, NULL);
+
+    dsfree(stack);
+    termFree(binds);
+    return (expr){ .data = ndata, .len = len, .aux = true };
+}
+
+size_t dbFunCount(expr e) {
+    size_t funs = 0;
+    for(byte *data = e.data; data < e.data + e.len; data += dbNodeLen(data)) {
+        funs += *(exprType *)data == EXPR_FUN;
+    }
+    return funs;
+}
+
+// Writes the named form of `e` with fresh binders to `ndata`, which needs
+// e.len + dbFunCount(e) * sizeof(bindt) bytes, and `binds` one entry per
+// EXPR_FUN. Free variables are taken from `free`
+void fromDeBruijnInto(expr e, byte *ndata, bindt *binds, depthStack *stack, bindList *free) {
+    size_t bottom = stack->len;
+    dspush(stack, 0);
+
+    byte *data = e.data;
+    byte *out = ndata;
+
+    while(stack->len > bottom) {
+        size_t depth = stack->items[--stack->len];
+        exprType type = *(exprType *)data;
+
+        if(false) {}
+        else if(isBind(type)) {
+            size_t index = dbIndex(data);
+            bindt bind = index < depth ? binds[depth - 1 - index] : free->items[index - depth];
+
+            *(exprType *)out = EXPR_BIND;
+            writeField(bindt, out + sizeof(exprType), bind);
+            out += BIND_LEN;
+            data += BIND_LEN;
+        }
+        else if(type == EXPR_FUN) {
+            var(bind);
+            binds[depth] = bind;
+            *(exprType *)out = EXPR_FUN;
+            writeField(bindt, out + sizeof(exprType), bind);
+            out += FUN_LEN;
+            data += sizeof(exprType);
+
+            dspush(stack, depth + 1);
+        }
+        else {
+            size_t len = dbNodeLen(data);
+            memcpy(out, data, len);
+            out += len;
+            data += len;
+
+            for(size_t i = 0; i < dbChildren(type); i++) dspush(stack, depth);
+        }
+    }
+}
+
+expr fromDeBruijn(expr e) {
+    size_t funs = dbFunCount(e);
+    size_t len = e.len + funs * sizeof(bindt);
+    bindt *binds = termAlloc((funs + 1) * sizeof(bindt));
+    byte *ndata = termAlloc(len);
+    depthStack stack = mkds();
+
+    fromDeBruijnInto(e, ndata, binds, &stack, NULL);
+
+    dsfree(stack);
+    termFree(binds);
+    return (expr){ .data = ndata, .len = len, .aux = true };
+}
+
+// Same redex order as scanForSubst: leftmost-outermost, impure functions
+// only fire on an EXPR_IMPURE_VAL argument, shared terms are copied in when
+// applied or not normal. Those are closed, so their de Bruijn form goes in as is
+bool dbScan(byte *odata, size_t *fpos, size_t *rpos, size_t *rlen, impureFunpt *imfun, expr *shared) {
+    byte *data = odata;
+    ssize_t depth = 1;
+    bool found = false;
+
+    while(depth > 0) {
+        exprType type = *(exprType *)data;
+
+        byte *ref = NULL;
+        if(type == EXPR_REF && !sharedAt(data + sizeof(exprType))->normal) ref = data;
+        if(type == EXPR_APP && *(exprType *)(data + sizeof(exprType)) == EXPR_REF) ref = data + sizeof(exprType);
+
+        if(ref != NULL) {
+            *fpos = ref - odata;
+            *rpos = *fpos;
+            *rlen = REF_LEN;
+            *imfun = NULL;
+            *shared = sharedAt(ref + sizeof(exprType))->canon;
+            found = true;
+            break;
+        }
+
+        if(type == EXPR_APP) {
+            byte *lhs = data + sizeof(exprType);
+            exprType lhsType = *(exprType *)lhs;
+
+            if(lhsType == EXPR_FUN) {
+                *fpos = data - odata;
+                *rpos = (lhs - odata) + getDbLen(lhs);
+                *rlen = getDbLen(odata + *rpos);
+                *imfun = NULL;
+                found = true;
+                break;
+            }
+            else if(lhsType == EXPR_IMPURE_FUN) {
+                byte *arg = lhs + IMPURE_FUN_LEN;
+                if(*(exprType *)arg == EXPR_IMPURE_VAL) {
+                    *fpos = data - odata;
+                    *rpos = arg - odata;
+                    *rlen = getDbLen(arg);
+                    *imfun = impureAt(lhs + sizeof(exprType));
+                    found = true;
+                    break;
+                }
+
+                data = arg;
+                continue;
+            }
+        }
+
+        depth += dbChildren(type);
+        data += dbNodeLen(data);
+        depth--;
+    }
+
+    runStats.scanPasses++;
+    runStats.bytesScanned += data - odata;
+    return found;
+}
+
+// The walks below go in pre-order and keep, for every node, the number of
+// binders between it and the root of the walk
+bool dbIsClosed(byte *data) {
+    depthStack stack = mkds();
+    dspush(&stack, 0);
+    bool closed = true;
+
+    while(stack.len > 0 && closed) {
+        size_t depth = stack.items[--stack.len];
+        exprType type = *(exprType *)data;
+
+        if(isBind(type) && dbIndex(data) >= depth) closed = false;
+        for(size_t i = 0; i < dbChildren(type); i++) dspush(&stack, depth + (type == EXPR_FUN));
+        data += dbNodeLen(data);
+    }
+
+    dsfree(stack);
+    return closed;
+}
+
+// Copies an argument `by` binders deeper than where it was: its free
+// variables move up by that much
+byte *dbShift(byte *data, byte *out, size_t by, depthStack *stack) {
+    size_t bottom = stack->len;
+    dspush(stack, 0);
+
+    while(stack->len > bottom) {
+        size_t depth = stack->items[--stack->len];
+        exprType type = *(exprType *)data;
+        size_t len = dbNodeLen(data);
+
+        memcpy(out, data, len);
+        if(isBind(type) && dbIndex(data) >= depth) {
+            writeField(bindt, out + sizeof(exprType), dbIndex(data) + by);
+        }
+
+        for(size_t i = 0; i < dbChildren(type); i++) dspush(stack, depth + (type == EXPR_FUN));
+        data += len;
+        out += len;
+    }
+
+    return out;
+}
+
+// Contracts (λ.body) arg at `fpos`: index 0 of the body becomes the argument,
+// shifted by the binders above each occurrence, and the body's other free
+// variables lose the binder that disappeared
+size_t dbBeta(byte *odata, size_t len, size_t fpos, size_t rpos, size_t rlen, byte *ndata, depthStack *stack) {
+    byte *body = odata + fpos + sizeof(exprType) + sizeof(exprType);
+    byte *arg = odata + rpos;
+    bool closed = dbIsClosed(arg);
+
+    memcpy(ndata, odata, fpos);
+    byte *out = ndata + fpos;
+    byte *data = body;
+
+    dspush(stack, 0);
+    while(stack->len > 0) {
+        size_t depth = stack->items[--stack->len];
+        exprType type = *(exprType *)data;
+        size_t nlen = dbNodeLen(data);
+
+        if(isBind(type) && dbIndex(data) == depth) {
+            if(closed || depth == 0) {
+                memcpy(out, arg, rlen);
+                out += rlen;
+            }
+            else {
+                out = dbShift(arg, out, depth, stack);
+            }
+        }
+        else if(isBind(type) && dbIndex(data) > depth) {
+            *(exprType *)out = EXPR_BIND;
+            writeField(bindt, out + sizeof(exprType), dbIndex(data) - 1);
+            out += nlen;
+        }
+        else {
+            memcpy(out, data, nlen);
+            out += nlen;
+        }
+
+        for(size_t i = 0; i < dbChildren(type); i++) dspush(stack, depth + (type == EXPR_FUN));
+        data += nlen;
+    }
+
+    size_t end = rpos + rlen;
+    memcpy(out, odata + end, len - end);
+    out += len - end;
+
+    return out - ndata;
+}
+
+// Upper bound of the length after contracting the redex at `fpos`
+size_t dbBetaLen(byte *odata, size_t len, size_t fpos, size_t rlen) {
+    byte *data = odata + fpos + sizeof(exprType) + sizeof(exprType);
+    size_t occurrences = 0;
+    depthStack stack = mkds();
+    dspush(&stack, 0);
+
+    while(stack.len > 0) {
+        size_t depth = stack.items[--stack.len];
+        exprType type = *(exprType *)data;
+
+        if(isBind(type) && dbIndex(data) == depth) occurrences++;
+        for(size_t i = 0; i < dbChildren(type); i++) dspush(&stack, depth + (type == EXPR_FUN));
+        data += dbNodeLen(data);
+    }
+
+    dsfree(stack);
+    return len - 2 * sizeof(exprType) - rlen + occurrences * (rlen - BIND_LEN);
+}
+
+void evaluateDeBruijn(expr *e) {
+    expr db = toDeBruijn(*e, NULL);
+    size_t cap = e->len;
+    byte *spare = NULL;
+    size_t spareCap = 0;
+    bool reduced = false;
+
+    depthStack stack = mkds();
+
+    size_t fpos;
+    size_t rpos;
+    size_t rlen;
+    impureFunpt imfun;
+    expr shared = {0};
+
+    int64_t scanStarted = statsClock();
+    while(fuelLeft() && dbScan(db.data, &fpos, &rpos, &rlen, &imfun, &shared)) {
+        int64_t started = statsClock();
+        runStats.scanNs += started - scanStarted;
+        reduced = true;
+
+        size_t newLen;
+        expr result = shared;
+        if(imfun != NULL) {
+            result = imfun(db.data + rpos, rlen);
+        }
+
+        if(imfun != NULL || shared.data != NULL) {
+            newLen = db.len - (rpos + rlen - fpos) + result.len;
+        }
+        else {
+            newLen = dbBetaLen(db.data, db.len, fpos, rlen);
+        }
+
+        if(false) {}
+        else if(imfun != NULL)       runStats.impureCalls++;
+        else if(shared.data != NULL) runStats.sharedCopies++;
+        else                         runStats.betaSteps++;
+        runStats.bytesMoved += newLen;
+        if(newLen > runStats.peakLen) runStats.peakLen = newLen;
+
+        if(spareCap < newLen) {
+            size_t ncap = spareCap * 2;
+            if(ncap < newLen) ncap = newLen;
+
+            termFree(spare);
+            spare = termAlloc(ncap);
+            spareCap = ncap;
+        }
+
+        if(imfun != NULL || shared.data != NULL) {
+            memcpy(spare, db.data, fpos);
+            memcpy(spare + fpos, result.data, result.len);
+            memcpy(spare + fpos + result.len, db.data + rpos + rlen, db.len - (rpos + rlen));
+            if(imfun != NULL) termFree(result.data);
+        }
+        else {
+            newLen = dbBeta(db.data, db.len, fpos, rpos, rlen, spare, &stack);
+        }
+
+        byte *old = db.data;
+        size_t oldCap = cap;
+        db.data = spare;
+        db.len = newLen;
+        cap = spareCap;
+        spare = old;
+        spareCap = oldCap;
+        shared = (expr){0};
+
+        scanStarted = statsClock();
+        runStats.spliceNs += scanStarted - started;
+    }
+    runStats.scanNs += statsClock() - scanStarted;
+
+    if(reduced) {
+        expr named = fromDeBruijn(db);
+        termFree(e->data);
+        e->data = named.data;
+        e->len = named.len;
+    }
+
+    dsfree(stack);
+    termFree(spare);
+    termFree(db.data);
+}
+
+// ==================
+// SHARING
+// ==================
+
+// Definitions are hash-consed: shareTerm keeps one copy of every closed term
+// up to alpha-equivalence and hands out an EXPR_REF to it, so building a term
+// only copies a few bytes per mention of Succ, Mul, ... The evaluators copy a
+// shared term into the term under evaluation only when it is applied, or when
+// it still has redexes of its own
+bool shareDefinitions = true;
+
+// Open addressing over sharedTable, holding index + 1 (0 is an empty slot)
+refId *sharedSlots = NULL;
+size_t sharedSlotsCap = 0;
+
+uint64_t hashBytes(byte *data, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Looks for a redex in a de Bruijn form, or a shared term that still has one
+bool dbIsNormal(expr canon) {
+    for(byte *data = canon.data; data < canon.data + canon.len; data += dbNodeLen(data)) {
+        exprType type = *(exprType *)data;
+
+        if(type == EXPR_REF && !sharedAt(data + sizeof(exprType))->normal) return false;
+        if(type != EXPR_APP) continue;
+
+        byte *lhs = data + sizeof(exprType);
+        exprType lhsType = *(exprType *)lhs;
+        if(lhsType == EXPR_FUN || lhsType == EXPR_REF) return false;
+        if(lhsType == EXPR_IMPURE_FUN && *(exprType *)(lhs + IMPURE_FUN_LEN) == EXPR_IMPURE_VAL) return false;
+    }
+
+    return true;
+}
+
+size_t sharedFind(expr canon, uint64_t hash) {
+    size_t mask = sharedSlotsCap - 1;
+    size_t slot = hash & mask;
+
+    while(sharedSlots[slot] != 0) {
+        sharedTerm *s = &sharedTable[sharedSlots[slot] - 1];
+        if(s->hash == hash && s->canon.len == canon.len && memcmp(s->canon.data, canon.data, canon.len) == 0) break;
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+void sharedGrow() {
+    refId *oslots = sharedSlots;
+    size_t ocap = sharedSlotsCap;
+
+    sharedSlotsCap = ocap == 0 ? 64 : ocap * 2;
+    sharedSlots = Malloc(sharedSlotsCap * sizeof(refId));
+    memset(sharedSlots, 0, sharedSlotsCap * sizeof(refId));
+
+    for(size_t i = 0; i < ocap; i++) {
+        if(oslots[i] == 0) continue;
+        sharedTerm *s = &sharedTable[oslots[i] - 1];
+        sharedSlots[sharedFind(s->canon, s->hash)] = oslots[i];
+    }
+    Free(oslots);
+}
+
+// Returns an EXPR_REF to `e` on the heap. Terms that are not closed, impure
+// values and terms that already are a reference are only detached
+expr shareTerm(expr e) {
+    exprType type = *(exprType *)e.data;
+    if(!shareDefinitions || (type != EXPR_FUN && type != EXPR_APP)) return termDetach(e);
+
+    bool closed = true;
+    expr canon = toDeBruijn(e, &closed);
+    if(!closed) {
+        termFree(canon.data);
+        return termDetach(e);
+    }
+
+    if((size_t)(sharedCount + 1) * 2 > sharedSlotsCap) sharedGrow();
+
+    uint64_t hash = hashBytes(canon.data, canon.len);
+    size_t slot = sharedFind(canon, hash);
+
+    if(sharedSlots[slot] == 0) {
+        if(sharedCount == sharedCap) {
+            sharedCap = sharedCap * 2 + 16;
+            sharedTable = Realloc(sharedTable, sharedCap * sizeof(sharedTerm));
+        }
+
+        sharedTerm *s = &sharedTable[sharedCount];
+        s->term = (expr){ .data = Malloc(e.len), .len = e.len, .aux = false };
+        s->canon = (expr){ .data = Malloc(canon.len), .len = canon.len, .aux = false };
+        memcpy(s->term.data, e.data, e.len);
+        memcpy(s->canon.data, canon.data, canon.len);
+        s->hash = hash;
+        s->normal = dbIsNormal(canon);
+
+        sharedSlots[slot] = ++sharedCount;
+    }
+    termFree(canon.data);
+
+    byte *data = Malloc(REF_LEN);
+    *(exprType *)data = EXPR_REF;
+    writeField(refId, data + sizeof(exprType), sharedSlots[slot] - 1);
+    return (expr){ .data = data, .len = REF_LEN, .aux = false };
+}
+
+// ==================
+// NORMAL FORM CACHE
+// ==================
+
+// Optional memo from applications to their normal forms, keyed by de Bruijn
+// form (free variables numbered in order of first occurrence) so
+// alpha-equivalent terms hit the same entry wherever they are. evaluate looks
+// up whole terms; evaluateSingle looks up the spine around every shared term
+// it applies, which normal order would fully normalize in place anyway.
+// Impure functions are assumed to be deterministic. When full, the least
+// recently used entry goes
+
+#define NORMAL_CACHE_SIZE 1024
+
+// `nf` is in de Bruijn form, links are entry index + 1, 0 means none
+typedef struct {
+    uint64_t hash;
+    expr key;
+    expr nf;
+    size_t prev;
+    size_t next;
+    size_t chain;
+} normalEntry;
+
+_Thread_local normalEntry normalCache[NORMAL_CACHE_SIZE];
+_Thread_local size_t normalBuckets[NORMAL_CACHE_SIZE * 2];
+_Thread_local size_t normalUsed = 0;
+_Thread_local size_t normalHead = 0;
+_Thread_local size_t normalTail = 0;
+
+_Thread_local int64_t normalCacheHits = 0;
+_Thread_local int64_t normalCacheMisses = 0;
+_Thread_local int64_t normalCacheEvictions = 0;
+
+// Conversions go through scratch space kept across lookups, on the heap
+_Thread_local byte *normalScratch = NULL;
+_Thread_local bindt *normalBinds = NULL;
+_Thread_local size_t normalScratchCap = 0;
+_Thread_local byte *normalOut = NULL;
+_Thread_local size_t normalOutCap = 0;
+_Thread_local depthStack normalStack = {0};
+_Thread_local bindList normalFree = {0};
+
+void normalFit(size_t len) {
+    if(normalScratchCap >= len) return;
+
+    Free(normalScratch);
+    Free(normalBinds);
+    normalScratchCap = len * 2;
+    normalScratch = Malloc(normalScratchCap);
+    normalBinds = Malloc(normalScratchCap * sizeof(bindt));
+}
+
+// De Bruijn form of `e` in normalScratch, its free variables in normalFree
+expr normalKey(expr e) {
+    arena *prev = arenaEnter(NULL);
+
+    if(normalStack.items == NULL) normalStack = mkds();
+    if(normalFree.items == NULL) normalFree = mkbl();
+
+    normalFit(e.len);
+    normalFree.len = 0;
+    size_t len = deBruijnInto(e, normalScratch, normalBinds, &normalStack, NULL, &normalFree);
+
+    arenaLeave(prev);
+    return (expr){ .data = normalScratch, .len = len, .aux = false };
+}
+
+void normalOutFit(size_t len) {
+    if(normalOutCap >= len) return;
+
+    Free(normalOut);
+    normalOutCap = len * 2;
+    normalOut = Malloc(normalOutCap);
+}
+
+// Named form of a cached normal form in normalOut, over normalFree
+expr normalMaterialize(expr nf) {
+    arena *prev = arenaEnter(NULL);
+
+    size_t funs = dbFunCount(nf);
+    size_t len = nf.len + funs * sizeof(bindt);
+    normalOutFit(len);
+    normalFit(funs + 1);
+    fromDeBruijnInto(nf, normalOut, normalBinds, &normalStack, &normalFree);
+
+    arenaLeave(prev);
+    return (expr){ .data = normalOut, .len = len, .aux = false };
+}
+
+size_t *normalBucket(uint64_t hash) {
+    return &normalBuckets[hash & (NORMAL_CACHE_SIZE * 2 - 1)];
+}
+
+void normalUnlink(size_t i) {
+    normalEntry *n = &normalCache[i - 1];
+    if(n->prev != 0) normalCache[n->prev - 1].next = n->next;
+    else             normalHead = n->next;
+    if(n->next != 0) normalCache[n->next - 1].prev = n->prev;
+    else             normalTail = n->prev;
+}
+
+void normalPushFront(size_t i) {
+    normalEntry *n = &normalCache[i - 1];
+    n->prev = 0;
+    n->next = normalHead;
+    if(normalHead != 0) normalCache[normalHead - 1].prev = i;
+    normalHead = i;
+    if(normalTail == 0) normalTail = i;
+}
+
+size_t normalFind(expr key, uint64_t hash) {
+    for(size_t i = *normalBucket(hash); i != 0; i = normalCache[i - 1].chain) {
+        normalEntry *n = &normalCache[i - 1];
+        if(n->hash == hash && n->key.len == key.len && memcmp(n->key.data, key.data, key.len) == 0) return i;
+    }
+    return 0;
+}
+
+// Takes ownership of `key` and `nf`
+size_t normalInsert(expr key, uint64_t hash, expr nf) {
+    size_t i;
+    if(normalUsed < NORMAL_CACHE_SIZE) {
+        i = ++normalUsed;
+    }
+    else {
+        i = normalTail;
+        normalEntry *old = &normalCache[i - 1];
+
+        size_t *link = normalBucket(old->hash);
+        while(*link != i) link = &normalCache[*link - 1].chain;
+        *link = old->chain;
+
+        normalUnlink(i);
+        Free(old->key.data);
+        Free(old->nf.data);
+        normalCacheEvictions++;
+    }
+
+    normalEntry *n = &normalCache[i - 1];
+    n->hash = hash;
+    n->key = key;
+    n->nf = nf;
+
+    size_t *bucket = normalBucket(hash);
+    n->chain = *bucket;
+    *bucket = i;
+    normalPushFront(i);
+
+    return i;
+}
+
+// Points `nf` at the normal form of `t`, with fresh binders and the same free
+// variables, running `eval` on a copy of `t` on a miss. It stays valid until
+// the next lookup
+void normalCached(expr t, expr *nf, void (*eval)(expr *)) {
+    expr key = normalKey(t);
+    uint64_t hash = hashBytes(key.data, key.len);
+    size_t i = normalFind(key, hash);
+
+    if(i != 0) {
+        normalCacheHits++;
+        normalUnlink(i);
+        normalPushFront(i);
+        *nf = normalMaterialize(normalCache[i - 1].nf);
+        return;
+    }
+
+    normalCacheMisses++;
+
+    // The evaluation below does lookups of its own
+    arena *prev = arenaEnter(NULL);
+    expr okey = { .data = Malloc(key.len), .len = key.len, .aux = false };
+    memcpy(okey.data, key.data, key.len);
+    bindList outerFree = normalFree;
+    normalFree = mkbl();
+    arenaLeave(prev);
+
+    expr work = { .data = termAlloc(t.len), .len = t.len, .aux = true };
+    memcpy(work.data, t.data, t.len);
+    eval(&work);
+
+    prev = arenaEnter(NULL);
+    blfree(normalFree);
+    normalFree = outerFree;
+
+    // Out of fuel, `work` is only partly evaluated, so it's handed back
+    // without being cached
+    if(fuelExhausted) {
+        Free(okey.data);
+        normalOutFit(work.len);
+        memcpy(normalOut, work.data, work.len);
+        arenaLeave(prev);
+
+        *nf = (expr){ .data = normalOut, .len = work.len, .aux = false };
+        termFree(work.data);
+        return;
+    }
+
+    normalFit(work.len);
+    size_t len = deBruijnInto(work, normalScratch, normalBinds, &normalStack, NULL, &normalFree);
+    expr onf = { .data = Malloc(len), .len = len, .aux = false };
+    memcpy(onf.data, normalScratch, len);
+    arenaLeave(prev);
+
+    termFree(work.data);
+    i = normalInsert(okey, hash, onf);
+    *nf = normalMaterialize(normalCache[i - 1].nf);
+}
+
+// Turns the redex `r`, a shared term applied in the spine at `spos`, into
+// the splice of that whole spine's normal form
+void memoSpine(expr *e, size_t spos, redex *r) {
+    expr t = { .data = e->data + spos, .len = getExprLen(e->data + spos) };
+    if(spos == 0 && t.len == e->len) return;
+
+    expr nf;
+    normalCached(t, &nf, evaluateSingle);
+
+    *r = (redex){
+        .fpos = spos,
+        .end = spos + t.len,
+        .rpos = spos,
+        .rlen = t.len,
+        .shared = true,
+        .result = nf,
+    };
+}
+
+// ==================
+// CALL BY NEED
+// ==================
+
+// EVAL_LAZY runs the term on an environment machine instead of rewriting it.
+// The code is the term's de Bruijn form and is never copied: an application
+// pushes its argument as a thunk (code plus environment), a function pops one
+// into its environment, and a variable forces its thunk, which is then
+// overwritten with its value, so every argument is evaluated at most once.
+// Shared terms get one thunk each per evaluation. The machine only reaches
+// weak head normal form; the normal form is read back by going under binders
+// with fresh variables, and the thunks from outside stay shared. Nothing is
+// freed before the evaluation ends. Terms without a normal form, like YC
+// itself, still need DefunLazy/DefvarLazy
+//
+// EVAL_KRIVINE is the same machine without the updates, plain call by name:
+// an argument is evaluated again at every use, the way normal order does it,
+// but still without copying anything
+
+#define LAZY_THUNK 0
+#define LAZY_BUSY 1
+#define LAZY_FUN 2
+#define LAZY_VAR 3
+#define LAZY_STUCK 4
+#define LAZY_VAL 5
+#define LAZY_IMPURE 6
+
+// THUNK, BUSY (being forced) and FUN are code + environment, VAL and IMPURE
+// point at their node in the code, VAR is a binder and STUCK an application
+// that can't reduce, `head` applied to `arg`. `ref` is the shared term the
+// node stands for, + 1 (0 if none)
+typedef struct lazyNode {
+    byte kind;
+    refId ref;
+    bindt bind;
+    byte *code;
+    uint32_t *lens;
+    struct lazyEnv *env;
+    struct lazyNode *head;
+    struct lazyNode *arg;
+} lazyNode;
+
+typedef struct lazyEnv {
+    lazyNode *node;
+    struct lazyEnv *next;
+} lazyEnv;
+
+// What the value being returned goes to: an argument to apply it to, a
+// thunk to overwrite with it, or an impure function it is the argument of
+#define LAZY_ARG 0
+#define LAZY_UPDATE 1
+#define LAZY_APPLY 2
+
+typedef struct {
+    byte kind;
+    lazyNode *node;
+} lazyFrame;
+
+typedef struct {
+    lazyFrame *items;
+    size_t len;
+    size_t cap;
+} lazyStack;
+
+static inline void lspush(lazyStack *stack, lazyFrame frame) {
+    if(stack->len == stack->cap) {
+        lazyFrame *nitems = termAlloc((stack->cap * 2 + 1) * sizeof(lazyFrame));
+        memcpy(nitems, stack->items, stack->len * sizeof(lazyFrame));
+        termFree(stack->items);
+        stack->items = nitems;
+        stack->cap = stack->cap * 2 + 1;
+    }
+
+    stack->items[stack->len] = frame;
+    (stack->len)++;
+}
+
+#define lsinit (256)
+#define mkls() ((lazyStack){ .items = termAlloc(lsinit * sizeof(lazyFrame)), .len = 0, .cap = lsinit })
+
+// Everything of one evaluation lives in lazyArena. The length indexes of the
+// shared terms are kept on the heap, they don't change
+_Thread_local arena lazyArena = {0};
+_Thread_local lazyNode **lazyRefs = NULL;
+_Thread_local bindList lazyFree = {0};
+_Thread_local lazyStack lazyFrames = {0};
+_Thread_local uint32_t **lazySharedLens = NULL;
+_Thread_local refId lazySharedLensCap = 0;
+_Thread_local bool lazyUpdates = true;
+
+lazyNode *lazyNew(byte kind) {
+    lazyNode *n = arenaAlloc(&lazyArena, sizeof(lazyNode));
+    memset(n, 0, sizeof(lazyNode));
+    n->kind = kind;
+    return n;
+}
+
+lazyNode *lazyThunk(byte *code, uint32_t *lens, lazyEnv *env) {
+    lazyNode *n = lazyNew(LAZY_THUNK);
+    n->code = code;
+    n->lens = lens;
+    n->env = env;
+    return n;
+}
+
+lazyNode *lazyStuck(lazyNode *head, lazyNode *arg) {
+    lazyNode *n = lazyNew(LAZY_STUCK);
+    n->head = head;
+    n->arg = arg;
+    return n;
+}
+
+lazyEnv *lazyBind(lazyNode *node, lazyEnv *next) {
+    lazyEnv *env = arenaAlloc(&lazyArena, sizeof(lazyEnv));
+    env->node = node;
+    env->next = next;
+    return env;
+}
+
+// Past the end of the environment are the free variables of the term
+lazyNode *lazyLookup(lazyEnv *env, size_t index) {
+    for(; env != NULL; env = env->next) {
+        if(index == 0) return env->node;
+        index--;
+    }
+
+    lazyNode *n = lazyNew(LAZY_VAR);
+    n->bind = lazyFree.items[index];
+    return n;
+}
+
+lazyNode *lazyRef(refId id) {
+    if(lazyRefs[id] != NULL) return lazyRefs[id];
+
+    if(id >= lazySharedLensCap) {
+        refId ncap = sharedCount;
+        lazySharedLens = Realloc(lazySharedLens, ncap * sizeof(uint32_t *));
+        memset(lazySharedLens + lazySharedLensCap, 0, (ncap - lazySharedLensCap) * sizeof(uint32_t *));
+        lazySharedLensCap = ncap;
+    }
+
+    expr canon = sharedTable[id].canon;
+    if(lazySharedLens[id] == NULL) {
+        indexStack stack = mkix();
+        lazySharedLens[id] = Malloc(canon.len * sizeof(uint32_t));
+        dbBuildLenIndex(canon.data, canon.len, lazySharedLens[id], &stack);
+        ixfree(stack);
+    }
+
+    lazyNode *n = lazyThunk(canon.data, lazySharedLens[id], NULL);
+    n->ref = id + 1;
+    lazyRefs[id] = n;
+    return n;
+}
+
+// Starts forcing `n` if it is a thunk, otherwise returns its value. Without
+// `update` the thunk is only run, and stays a thunk
+lazyNode *lazyEnter(lazyNode *n, byte **code, uint32_t **lens, lazyEnv **env, bool update) {
+    if(n->kind == LAZY_BUSY) {
+        printf("Infinite loop: a thunk needs its own value\n");
+        exit(1);
+    }
+    if(n->kind != LAZY_THUNK) return n;
+
+    if(update) {
+        lspush(&lazyFrames, (lazyFrame){ .kind = LAZY_UPDATE, .node = n });
+        n->kind = LAZY_BUSY;
+    }
+    *code = n->code;
+    *lens = n->lens;
+    *env = n->env;
+    if(n->ref != 0) runStats.sharedCopies++;
+    return NULL;
+}
+
+// Brings `t` to weak head normal form in place. `v` is the value being
+// returned to the frames, NULL while code is being run
+void lazyWhnf(lazyNode *t) {
+    byte *code;
+    uint32_t *lens;
+    lazyEnv *env;
+    lazyNode *v = lazyEnter(t, &code, &lens, &env, true);
+
+    while(true) {
+        if(v == NULL) {
+            exprType type = *(exprType *)code;
+            lazyStack *stack = &lazyFrames;
+
+            if(false) {}
+            else if(type == EXPR_APP) {
+                byte *arg = code + sizeof(exprType) + lens[sizeof(exprType)];
+                lspush(stack, (lazyFrame){ .kind = LAZY_ARG, .node = lazyThunk(arg, lens + (arg - code), env) });
+                code += sizeof(exprType);
+                lens += sizeof(exprType);
+            }
+            else if(type == EXPR_FUN && stack->len > 0 && stack->items[stack->len - 1].kind == LAZY_ARG) {
+                env = lazyBind(stack->items[--stack->len].node, env);
+                code += sizeof(exprType);
+                lens += sizeof(exprType);
+                runStats.betaSteps++;
+            }
+            else if(type == EXPR_FUN) {
+                v = lazyThunk(code, lens, env);
+                v->kind = LAZY_FUN;
+            }
+            else if(isBind(type)) {
+                v = lazyEnter(lazyLookup(env, dbIndex(code)), &code, &lens, &env, lazyUpdates);
+            }
+            else if(type == EXPR_REF) {
+                v = lazyEnter(lazyRef(readField(refId, code + sizeof(exprType))), &code, &lens, &env, lazyUpdates);
+            }
+            else if(type == EXPR_IMPURE_VAL) {
+                v = lazyThunk(code, lens, NULL);
+                v->kind = LAZY_VAL;
+            }
+            else if(type == EXPR_IMPURE_FUN) {
+                v = lazyThunk(code, lens, NULL);
+                v->kind = LAZY_IMPURE;
+            }
+            continue;
+        }
+
+        if(lazyFrames.len == 0) break;
+        lazyFrame frame = lazyFrames.items[--lazyFrames.len];
+
+        if(false) {}
+        else if(frame.kind == LAZY_UPDATE) {
+            refId ref = v->ref != 0 ? v->ref : frame.node->ref;
+            *frame.node = *v;
+            frame.node->ref = ref;
+            v = frame.node;
+        }
+        else if(frame.kind == LAZY_ARG && v->kind == LAZY_FUN) {
+            env = lazyBind(frame.node, v->env);
+            code = v->code + sizeof(exprType);
+            lens = v->lens + sizeof(exprType);
+            v = NULL;
+            runStats.betaSteps++;
+        }
+        else if(frame.kind == LAZY_ARG && v->kind == LAZY_IMPURE) {
+            lspush(&lazyFrames, (lazyFrame){ .kind = LAZY_APPLY, .node = v });
+            v = lazyEnter(frame.node, &code, &lens, &env, lazyUpdates);
+        }
+        else if(frame.kind == LAZY_ARG) {
+            v = lazyStuck(v, frame.node);
+        }
+        else if(frame.kind == LAZY_APPLY && v->kind == LAZY_VAL) {
+            impureFunpt imfun = impureAt(frame.node->code + sizeof(exprType));
+            expr result = imfun(v->code, impureValLen(v->code));
+            runStats.impureCalls++;
+
+            if(*(exprType *)result.data == EXPR_IMPURE_VAL) {
+                v = lazyThunk(result.data, NULL, NULL);
+                v->kind = LAZY_VAL;
+            }
+            else {
+                expr db = toDeBruijn(result, NULL);
+                indexStack ixstack = mkix();
+                lens = termAlloc(db.len * sizeof(uint32_t));
+                dbBuildLenIndex(db.data, db.len, lens, &ixstack);
+                code = db.data;
+                env = NULL;
+                v = NULL;
+            }
+        }
+        else if(frame.kind == LAZY_APPLY) {
+            v = lazyStuck(frame.node, v);
+        }
+    }
+}
+
+// Writes the normal form of `root` in named form to a buffer in lazyArena.
+// Shared terms in normal form go back in as an EXPR_REF
+expr lazyReadBack(lazyNode *root) {
+    lazyStack pending = mkls();
+    lspush(&pending, (lazyFrame){ .node = root });
+
+    size_t cap = 256;
+    expr out = { .data = termAlloc(cap), .len = 0, .aux = true };
+
+    while(pending.len > 0) {
+        lazyNode *n = pending.items[--pending.len].node;
+
+        refId ref = n->ref;
+        if(ref == 0 && n->kind == LAZY_THUNK && *(exprType *)n->code == EXPR_REF) {
+            ref = readField(refId, n->code + sizeof(exprType)) + 1;
+        }
+        bool asRef = ref != 0 && sharedTable[ref - 1].normal;
+        if(!asRef) lazyWhnf(n);
+
+        size_t len = REF_LEN;
+        if(asRef)                        len = REF_LEN;
+        else if(n->kind == LAZY_FUN)     len = FUN_LEN;
+        else if(n->kind == LAZY_VAR)     len = BIND_LEN;
+        else if(n->kind == LAZY_STUCK)   len = sizeof(exprType);
+        else if(n->kind == LAZY_VAL)     len = impureValLen(n->code);
+        else if(n->kind == LAZY_IMPURE)  len = IMPURE_FUN_LEN;
+
+        if(out.len + len > cap) {
+            while(out.len + len > cap) cap *= 2;
+            byte *ndata = termAlloc(cap);
+            memcpy(ndata, out.data, out.len);
+            out.data = ndata;
+        }
+        byte *data = out.data + out.len;
+        out.len += len;
+
+        if(false) {}
+        else if(asRef) {
+            *(exprType *)data = EXPR_REF;
+            writeField(refId, data + sizeof(exprType), ref - 1);
+        }
+        else if(n->kind == LAZY_FUN) {
+            var(bind);
+            lazyNode *v = lazyNew(LAZY_VAR);
+            v->bind = bind;
+
+            *(exprType *)data = EXPR_FUN;
+            writeField(bindt, data + sizeof(exprType), bind);
+            lazyNode *body = lazyThunk(n->code + sizeof(exprType), n->lens + sizeof(exprType), lazyBind(v, n->env));
+            lspush(&pending, (lazyFrame){ .node = body });
+        }
+        else if(n->kind == LAZY_VAR) {
+            *(exprType *)data = EXPR_BIND;
+            writeField(bindt, data + sizeof(exprType), n->bind);
+        }
+        else if(n->kind == LAZY_STUCK) {
+            *(exprType *)data = EXPR_APP;
+            lspush(&pending, (lazyFrame){ .node = n->arg });
+            lspush(&pending, (lazyFrame){ .node = n->head });
+        }
+        else {
+            memcpy(data, n->code, len);
+        }
+    }
+
+    return out;
+}
+
+void lazyEvaluate(expr *e, bool updates) {
+    lazyUpdates = updates;
+    int64_t steps = runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies;
+    arena *prev = arenaEnter(&lazyArena);
+
+    lazyFree = mkbl();
+    lazyFrames = mkls();
+    lazyRefs = termAlloc((sharedCount + 1) * sizeof(lazyNode *));
+    memset(lazyRefs, 0, (sharedCount + 1) * sizeof(lazyNode *));
+
+    depthStack stack = mkds();
+    indexStack ixstack = mkix();
+    bindt *binds = termAlloc((e->len / FUN_LEN + 1) * sizeof(bindt));
+    byte *code = termAlloc(e->len);
+    size_t len = deBruijnInto(*e, code, binds, &stack, NULL, &lazyFree);
+    uint32_t *lens = termAlloc(len * sizeof(uint32_t));
+    dbBuildLenIndex(code, len, lens, &ixstack);
+
+    expr nf = lazyReadBack(lazyThunk(code, lens, NULL));
+
+    arenaLeave(prev);
+
+    // Like the other strategies, a term without redexes is left as it is
+    if(runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies > steps) {
+        runStats.bytesMoved += nf.len;
+        if(nf.len > runStats.peakLen) runStats.peakLen = nf.len;
+
+        termFree(e->data);
+        e->data = termAlloc(nf.len);
+        e->len = nf.len;
+        memcpy(e->data, nf.data, nf.len);
+    }
+
+    arenaReset(&lazyArena);
+}
+
+void evaluateLazy(expr *e) {
+    lazyEvaluate(e, true);
+}
+
+void evaluateKrivine(expr *e) {
+    lazyEvaluate(e, false);
+}
+
+// ==================
+// GRAPH REDUCTION
+// ==================
+
+// EVAL_GRAPH reduces a graph of heap nodes instead of a byte string. A beta
+// step copies only the paths of the body that lead to the variable and
+// points them at the argument, which is shared, not copied. Closed subgraphs
+// (shared terms, closed arguments) are never copied at all. The application
+// is then overwritten with an indirection to the result, so everything that
+// shares it sees the reduction. Normal order: the spine is unwound to weak
+// head normal form, then the arguments and bodies are normalized in place.
+// Dead nodes are reclaimed by a mark and sweep collector, which also skips
+// the indirections it finds on the way
+//
+// Nodes live in blocks that stay around between evaluations. The collector
+// only runs between two reduction steps, where everything alive is reachable
+// from graphRoot, graphFocus, graphRefs and the stacks
+
+#define GRAPH_FREE 0
+#define GRAPH_FUN 1
+#define GRAPH_APP 2
+#define GRAPH_VAR 3
+#define GRAPH_IND 4
+#define GRAPH_VAL 5
+#define GRAPH_IMPURE 6
+#define GRAPH_REF 7
+
+// `lhs` is the function of an APP, the body of a FUN and the target of an IND
+// (and the next free node); `rhs` the argument of an APP and the variable of
+// a FUN. VAL and IMPURE point at their node in the code. `ref` is the shared
+// term a node stands for, + 1. `epoch` and `copy` memoize one instantiation
+typedef struct graphNode {
+    byte kind;
+    bool closed;
+    bool normal;
+    bool marked;
+    refId ref;
+    bindt bind;
+    uint32_t epoch;
+    struct graphNode *lhs;
+    struct graphNode *rhs;
+    struct graphNode *copy;
+    byte *data;
+} graphNode;
+
+#define GRAPH_BLOCK 4096
+
+typedef struct graphBlock {
+    struct graphBlock *next;
+    graphNode nodes[GRAPH_BLOCK];
+} graphBlock;
+
+// Spine frames are applications waiting for their function, or (GRAPH_MARK)
+// an impure function application waiting for its argument
+#define GRAPH_SPINE 0
+#define GRAPH_MARK 1
+
+typedef struct {
+    byte kind;
+    graphNode *node;
+} graphFrame;
+
+typedef struct {
+    graphFrame *items;
+    size_t len;
+    size_t cap;
+} graphStack;
+
+static inline void gspush(graphStack *stack, graphFrame frame) {
+    if(stack->len == stack->cap) {
+        graphFrame *nitems = termAlloc((stack->cap * 2 + 1) * sizeof(graphFrame));
+        memcpy(nitems, stack->items, stack->len * sizeof(graphFrame));
+        termFree(stack->items);
+        stack->items = nitems;
+        stack->cap = stack->cap * 2 + 1;
+    }
+
+    stack->items[stack->len] = frame;
+    (stack->len)++;
+}
+
+#define gsinit (256)
+#define mkgs() ((graphStack){ .items = termAlloc(gsinit * sizeof(graphFrame)), .len = 0, .cap = gsinit })
+
+_Thread_local graphBlock *graphBlocks = NULL;
+_Thread_local graphNode *graphFreeList = NULL;
+_Thread_local size_t graphCapacity = 0;
+_Thread_local size_t graphAllocated = 0;
+_Thread_local size_t graphCollectedAt = 0;
+_Thread_local size_t graphLive = 0;
+_Thread_local uint32_t graphEpoch = 0;
+
+_Thread_local int64_t graphCollections = 0;
+_Thread_local int64_t graphFreed = 0;
+
+// Per evaluation, in graphArena
+_Thread_local arena graphArena = {0};
+_Thread_local graphNode *graphRoot = NULL;
+_Thread_local graphNode *graphFocus = NULL;
+_Thread_local graphNode **graphRefs = NULL;
+_Thread_local graphNode **graphFreeVars = NULL;
+_Thread_local bindList graphFreeBinds = {0};
+_Thread_local graphStack graphSpine = {0};
+_Thread_local graphStack graphWork = {0};
+_Thread_local graphStack graphPending = {0};
+
+graphNode *graphNew(byte kind) {
+    if(graphFreeList == NULL) {
+        graphBlock *block = Malloc(sizeof(graphBlock));
+        block->next = graphBlocks;
+        graphBlocks = block;
+        graphCapacity += GRAPH_BLOCK;
+
+        for(size_t i = 0; i < GRAPH_BLOCK; i++) {
+            block->nodes[i].kind = GRAPH_FREE;
+            block->nodes[i].marked = false;
+            block->nodes[i].lhs = graphFreeList;
+            graphFreeList = &block->nodes[i];
+        }
+    }
+
+    graphNode *n = graphFreeList;
+    graphFreeList = n->lhs;
+    memset(n, 0, sizeof(graphNode));
+    n->kind = kind;
+    graphAllocated++;
+    return n;
+}
+
+graphNode *graphApp(graphNode *lhs, graphNode *rhs) {
+    graphNode *n = graphNew(GRAPH_APP);
+    n->lhs = lhs;
+    n->rhs = rhs;
+    n->closed = lhs->closed && rhs->closed;
+    return n;
+}
+
+static inline graphNode *graphFollow(graphNode *n) {
+    while(n->kind == GRAPH_IND) n = n->lhs;
+    return n;
+}
+
+// Builds the graph of a de Bruijn form. A node is closed when none of its
+// variables point above it: `minRef` is the depth of the outermost binder
+// its variables point at
+typedef struct {
+    graphNode *node;
+    size_t depth;
+    size_t missing;
+    int64_t minRef;
+} graphBuild;
+
+graphNode *graphFromDeBruijn(expr db) {
+    size_t cap = 64;
+    size_t len = 0;
+    graphBuild *open = termAlloc(cap * sizeof(graphBuild));
+    graphNode **vars = termAlloc((dbFunCount(db) + 1) * sizeof(graphNode *));
+    graphNode *root = NULL;
+
+    for(byte *data = db.data; data < db.data + db.len; data += dbNodeLen(data)) {
+        exprType type = *(exprType *)data;
+        size_t depth = len == 0 ? 0 : open[len - 1].depth + (open[len - 1].node->kind == GRAPH_FUN);
+        int64_t ref = INT64_MAX;
+        graphNode *n;
+
+        if(false) {}
+        else if(type == EXPR_FUN) {
+            n = graphNew(GRAPH_FUN);
+            n->rhs = graphNew(GRAPH_VAR);
+            vars[depth] = n->rhs;
+        }
+        else if(type == EXPR_APP) {
+            n = graphNew(GRAPH_APP);
+        }
+        else if(isBind(type)) {
+            size_t index = dbIndex(data);
+            if(index < depth) {
+                n = vars[depth - 1 - index];
+            }
+            else {
+                size_t j = index - depth;
+                if(graphFreeVars[j] == NULL) {
+                    graphFreeVars[j] = graphNew(GRAPH_VAR);
+                    graphFreeVars[j]->bind = graphFreeBinds.items[j];
+                }
+                n = graphFreeVars[j];
+            }
+            ref = (int64_t)depth - 1 - (int64_t)index;
+        }
+        else if(type == EXPR_REF) {
+            n = graphNew(GRAPH_REF);
+            n->ref = readField(refId, data + sizeof(exprType)) + 1;
+            n->closed = true;
+        }
+        else {
+            n = graphNew(type == EXPR_IMPURE_VAL ? GRAPH_VAL : GRAPH_IMPURE);
+            n->data = data;
+            n->closed = true;
+        }
+
+        if(len == 0)                               root = n;
+        else if(open[len - 1].node->kind == GRAPH_FUN) open[len - 1].node->lhs = n;
+        else if(open[len - 1].missing == 2)        open[len - 1].node->lhs = n;
+        else                                       open[len - 1].node->rhs = n;
+
+        if(dbChildren(type) > 0) {
+            if(len == cap) {
+                graphBuild *nopen = termAlloc(cap * 2 * sizeof(graphBuild));
+                memcpy(nopen, open, len * sizeof(graphBuild));
+                open = nopen;
+                cap *= 2;
+            }
+            open[len++] = (graphBuild){ .node = n, .depth = depth, .missing = dbChildren(type), .minRef = INT64_MAX };
+            continue;
+        }
+
+        while(len > 0) {
+            graphBuild *top = &open[len - 1];
+            if(ref < top->minRef) top->minRef = ref;
+            if(--(top->missing) > 0) break;
+
+            top->node->closed = top->minRef >= (int64_t)top->depth;
+            ref = top->minRef;
+            len--;
+        }
+    }
+
+    return root;
+}
+
+// The graph of a shared term, built once per evaluation
+graphNode *graphRef(refId id) {
+    if(graphRefs[id] == NULL) {
+        graphRefs[id] = graphFromDeBruijn(sharedTable[id].canon);
+        graphRefs[id]->ref = id + 1;
+        graphRefs[id]->closed = true;
+    }
+    return graphRefs[id];
+}
+
+// Marks everything reachable from `n`, pointing the edges past indirections
+void graphMark(graphNode *n, graphStack *stack) {
+    gspush(stack, (graphFrame){ .node = n });
+
+    while(stack->len > 0) {
+        n = stack->items[--stack->len].node;
+        if(n->marked) continue;
+        n->marked = true;
+
+        if(false) {}
+        else if(n->kind == GRAPH_IND) {
+            gspush(stack, (graphFrame){ .node = n->lhs });
+        }
+        else if(n->kind == GRAPH_APP || n->kind == GRAPH_FUN) {
+            n->lhs = graphFollow(n->lhs);
+            n->rhs = graphFollow(n->rhs);
+            gspush(stack, (graphFrame){ .node = n->lhs });
+            gspush(stack, (graphFrame){ .node = n->rhs });
+        }
+    }
+}
+
+void graphCollect() {
+    graphStack stack = mkgs();
+
+    if(graphRoot != NULL) graphMark(graphRoot, &stack);
+    if(graphFocus != NULL) graphMark(graphFocus, &stack);
+    for(refId i = 0; i < sharedCount; i++) {
+        if(graphRefs[i] != NULL) graphMark(graphRefs[i], &stack);
+    }
+    for(size_t i = 0; i < graphFreeBinds.len; i++) {
+        if(graphFreeVars[i] != NULL) graphMark(graphFreeVars[i], &stack);
+    }
+    for(size_t i = 0; i < graphSpine.len; i++) graphMark(graphSpine.items[i].node, &stack);
+    for(size_t i = 0; i < graphWork.len; i++) graphMark(graphWork.items[i].node, &stack);
+
+    graphLive = 0;
+    for(graphBlock *block = graphBlocks; block != NULL; block = block->next) {
+        for(size_t i = 0; i < GRAPH_BLOCK; i++) {
+            graphNode *n = &block->nodes[i];
+
+            if(n->marked) {
+                n->marked = false;
+                graphLive++;
+            }
+            else if(n->kind != GRAPH_FREE) {
+                n->kind = GRAPH_FREE;
+                n->lhs = graphFreeList;
+                graphFreeList = n;
+                graphFreed++;
+            }
+        }
+    }
+
+    termFree(stack.items);
+    graphCollections++;
+    graphCollectedAt = graphAllocated;
+}
+
+// Collects once the nodes allocated since the last collection outnumber the
+// ones that survived it
+void graphMaybeCollect() {
+    if(graphAllocated - graphCollectedAt < graphLive + GRAPH_BLOCK) return;
+    graphCollect();
+}
+
+// Everything goes back to the free list once the evaluation is over
+void graphReset() {
+    graphFreeList = NULL;
+    for(graphBlock *block = graphBlocks; block != NULL; block = block->next) {
+        for(size_t i = 0; i < GRAPH_BLOCK; i++) {
+            block->nodes[i].kind = GRAPH_FREE;
+            block->nodes[i].marked = false;
+            block->nodes[i].lhs = graphFreeList;
+            graphFreeList = &block->nodes[i];
+        }
+    }
+    graphAllocated = 0;
+    graphCollectedAt = 0;
+    graphLive = 0;
+}
+
+// The instantiated node, or NULL if it still has to be visited
+static inline graphNode *graphResolved(graphNode *n) {
+    n = graphFollow(n);
+    if(n->epoch == graphEpoch) return n->copy;
+    if(n->closed || (n->kind != GRAPH_FUN && n->kind != GRAPH_APP)) return n;
+    return NULL;
+}
+
+// `body` with `var` replaced by `arg`. Only the nodes above an occurrence are
+// copied, each one once; copied functions get a fresh variable
+graphNode *graphInstantiate(graphNode *body, graphNode *var, graphNode *arg) {
+    graphEpoch++;
+    var->epoch = graphEpoch;
+    var->copy = arg;
+
+    graphStack *stack = &graphPending;
+    if(graphResolved(body) == NULL) gspush(stack, (graphFrame){ .kind = false, .node = graphFollow(body) });
+
+    while(stack->len > 0) {
+        graphFrame *top = &stack->items[stack->len - 1];
+        graphNode *n = top->node;
+
+        if(n->epoch == graphEpoch) {
+            stack->len--;
+            continue;
+        }
+
+        if(!top->kind) {
+            top->kind = true;
+            if(n->kind == GRAPH_FUN) {
+                n->rhs->epoch = graphEpoch;
+                n->rhs->copy = graphNew(GRAPH_VAR);
+            }
+            if(graphResolved(n->lhs) == NULL) gspush(stack, (graphFrame){ .kind = false, .node = graphFollow(n->lhs) });
+            if(n->kind == GRAPH_APP && graphResolved(n->rhs) == NULL) gspush(stack, (graphFrame){ .kind = false, .node = graphFollow(n->rhs) });
+            continue;
+        }
+
+        stack->len--;
+        graphNode *lhs = graphResolved(n->lhs);
+        graphNode *copy = n;
+
+        if(n->kind == GRAPH_FUN && lhs != graphFollow(n->lhs)) {
+            copy = graphNew(GRAPH_FUN);
+            copy->lhs = lhs;
+            copy->rhs = n->rhs->copy;
+        }
+        else if(n->kind == GRAPH_APP) {
+            graphNode *rhs = graphResolved(n->rhs);
+            if(lhs != graphFollow(n->lhs) || rhs != graphFollow(n->rhs)) copy = graphApp(lhs, rhs);
+        }
+
+        n->epoch = graphEpoch;
+        n->copy = copy;
+    }
+
+    return graphResolved(body);
+}
+
+// Result of an impure function, as a graph
+graphNode *graphImpureResult(graphNode *fun, graphNode *val) {
+    impureFunpt imfun = impureAt(fun->data + sizeof(exprType));
+    expr result = imfun(val->data, impureValLen(val->data));
+    runStats.impureCalls++;
+
+    if(*(exprType *)result.data == EXPR_IMPURE_VAL) {
+        graphNode *n = graphNew(GRAPH_VAL);
+        n->data = result.data;
+        n->closed = true;
+        return n;
+    }
+
+    return graphFromDeBruijn(toDeBruijn(result, NULL));
+}
+
+// Reduces `focus` to weak head normal form in place
+void graphWhnf(graphNode *focus) {
+    graphFocus = focus;
+    graphSpine.len = 0;
+    graphNode *n = graphFollow(focus);
+
+    while(true) {
+        graphMaybeCollect();
+
+        while(n->kind == GRAPH_APP) {
+            gspush(&graphSpine, (graphFrame){ .kind = GRAPH_SPINE, .node = n });
+            n = graphFollow(n->lhs);
+        }
+
+        graphFrame *top = graphSpine.len > 0 ? &graphSpine.items[graphSpine.len - 1] : NULL;
+        bool applied = top != NULL && top->kind == GRAPH_SPINE;
+
+        if(n->kind == GRAPH_REF) {
+            refId id = n->ref - 1;
+            n->kind = GRAPH_IND;
+            n->lhs = graphRef(id);
+            n = graphFollow(n);
+            runStats.sharedCopies++;
+            continue;
+        }
+
+        if(n->kind == GRAPH_FUN && applied) {
+            graphNode *app = top->node;
+            graphSpine.len--;
+
+            graphNode *result = graphInstantiate(n->lhs, n->rhs, app->rhs);
+            if(app->closed) result->closed = true;
+            app->kind = GRAPH_IND;
+            app->lhs = result;
+            runStats.betaSteps++;
+
+            n = graphFollow(result);
+            continue;
+        }
+
+        if(n->kind == GRAPH_IMPURE && applied) {
+            gspush(&graphSpine, (graphFrame){ .kind = GRAPH_MARK, .node = top->node });
+            n = graphFollow(top->node->rhs);
+            continue;
+        }
+
+        // `n` is a head normal form. Its arguments up to the nearest mark
+        // stay as they are, then the impure function there gets its argument
+        bool done = true;
+        while(graphSpine.len > 0) {
+            graphFrame frame = graphSpine.items[--graphSpine.len];
+            if(frame.kind == GRAPH_SPINE) continue;
+
+            graphNode *app = frame.node;
+            graphNode *arg = graphFollow(app->rhs);
+            if(arg->kind != GRAPH_VAL) continue;
+
+            graphNode *result = graphImpureResult(graphFollow(app->lhs), arg);
+            app->kind = GRAPH_IND;
+            app->lhs = result;
+            graphSpine.len--;
+
+            n = graphFollow(result);
+            done = false;
+            break;
+        }
+
+        if(done) break;
+    }
+
+    graphFocus = NULL;
+}
+
+// Shared terms in normal form stay as they are, the readback turns them back
+// into an EXPR_REF
+static inline bool graphIsSharedNormal(graphNode *n) {
+    return n->ref != 0 && sharedTable[n->ref - 1].normal && (n->kind == GRAPH_REF || graphRefs[n->ref - 1] == n);
+}
+
+void graphNormalize(graphNode *root) {
+    graphWork.len = 0;
+    gspush(&graphWork, (graphFrame){ .node = root });
+
+    while(graphWork.len > 0) {
+        graphNode *n = graphWork.items[--graphWork.len].node;
+        n = graphFollow(n);
+        if(n->normal || graphIsSharedNormal(n)) continue;
+
+        graphWhnf(n);
+        n = graphFollow(n);
+        n->normal = true;
+
+        if(n->kind == GRAPH_FUN) gspush(&graphWork, (graphFrame){ .node = n->lhs });
+        if(n->kind == GRAPH_APP) {
+            gspush(&graphWork, (graphFrame){ .node = n->rhs });
+            gspush(&graphWork, (graphFrame){ .node = n->lhs });
+        }
+    }
+}
+
+// Named form of a normalized graph, in graphArena. Every function gets a
+// fresh binder, a function shared in several places included
+expr graphReadBack(graphNode *root) {
+    graphStack pending = mkgs();
+    gspush(&pending, (graphFrame){ .node = root });
+
+    size_t cap = 256;
+    expr out = { .data = termAlloc(cap), .len = 0, .aux = true };
+
+    while(pending.len > 0) {
+        graphNode *n = graphFollow(pending.items[--pending.len].node);
+        bool asRef = graphIsSharedNormal(n);
+
+        size_t len = REF_LEN;
+        if(asRef)                         len = REF_LEN;
+        else if(n->kind == GRAPH_FUN)     len = FUN_LEN;
+        else if(n->kind == GRAPH_VAR)     len = BIND_LEN;
+        else if(n->kind == GRAPH_APP)     len = sizeof(exprType);
+        else if(n->kind == GRAPH_VAL)     len = impureValLen(n->data);
+        else if(n->kind == GRAPH_IMPURE)  len = IMPURE_FUN_LEN;
+
+        if(out.len + len > cap) {
+            while(out.len + len > cap) cap *= 2;
+            byte *ndata = termAlloc(cap);
+            memcpy(ndata, out.data, out.len);
+            out.data = ndata;
+        }
+        byte *data = out.data + out.len;
+        out.len += len;
+
+        if(false) {}
+        else if(asRef) {
+            *(exprType *)data = EXPR_REF;
+            writeField(refId, data + sizeof(exprType), n->ref - 1);
+        }
+        else if(n->kind == GRAPH_FUN) {
+            var(bind);
+            n->rhs->bind = bind;
+            *(exprType *)data = EXPR_FUN;
+            writeField(bindt, data + sizeof(exprType), bind);
+            gspush(&pending, (graphFrame){ .node = n->lhs });
+        }
+        else if(n->kind == GRAPH_VAR) {
+            *(exprType *)data = EXPR_BIND;
+            writeField(bindt, data + sizeof(exprType), n->bind);
+        }
+        else if(n->kind == GRAPH_APP) {
+            *(exprType *)data = EXPR_APP;
+            gspush(&pending, (graphFrame){ .node = n->rhs });
+            gspush(&pending, (graphFrame){ .node = n->lhs });
+        }
+        else {
+            memcpy(data, n->data, len);
+        }
+    }
+
+    return out;
+}
+
+void evaluateGraph(expr *e) {
+    int64_t steps = runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies;
+    arena *prev = arenaEnter(&graphArena);
+
+    graphSpine = mkgs();
+    graphWork = mkgs();
+    graphPending = mkgs();
+    graphRefs = termAlloc((sharedCount + 1) * sizeof(graphNode *));
+    memset(graphRefs, 0, (sharedCount + 1) * sizeof(graphNode *));
+
+    depthStack stack = mkds();
+    graphFreeBinds = mkbl();
+    bindt *binds = termAlloc((e->len / FUN_LEN + 1) * sizeof(bindt));
+    byte *code = termAlloc(e->len);
+    size_t len = deBruijnInto(*e, code, binds, &stack, NULL, &graphFreeBinds);
+    graphFreeVars = termAlloc((graphFreeBinds.len + 1) * sizeof(graphNode *));
+    memset(graphFreeVars, 0, (graphFreeBinds.len + 1) * sizeof(graphNode *));
+
+    graphRoot = graphFromDeBruijn((expr){ .data = code, .len = len });
+    graphNormalize(graphRoot);
+    expr nf = graphReadBack(graphRoot);
+
+    arenaLeave(prev);
+
+    if(runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies > steps) {
+        runStats.bytesMoved += nf.len;
+        if(nf.len > runStats.peakLen) runStats.peakLen = nf.len;
+
+        termFree(e->data);
+        e->data = termAlloc(nf.len);
+        e->len = nf.len;
+        memcpy(e->data, nf.data, nf.len);
+    }
+
+    graphRoot = NULL;
+    graphFreeBinds = (bindList){0};
+    graphReset();
+    arenaReset(&graphArena);
+}
+
+// ==================
+// NATIVE NUMERALS
+// ==================
+
+// Shared terms are recognized structurally as Church numerals, True, or one
+// of the usual operators on them, so EVAL_NATIVE can run them as machine
+// integers (see NORMALIZATION BY EVALUATION). A numeral is λs.λz.s (… (s z)),
+// False is the same term as Zero. Operators are matched against the patterns
+// below, over de Bruijn form in pre-order: L is a function, @ an
+// application, a digit a variable, and a letter a subterm of that kind,
+// either shared or written out (S Succ, T True, F False, N Not, A the helper
+// of Pred)
+
+#define NATIVE_NONE 1
+#define NATIVE_NUM 2
+#define NATIVE_TRUE 3
+#define NATIVE_SUCC 4
+#define NATIVE_SUM 5
+#define NATIVE_MUL 6
+#define NATIVE_PRED 7
+#define NATIVE_ISZERO 8
+#define NATIVE_AND 9
+#define NATIVE_OR 10
+#define NATIVE_NOT 11
+#define NATIVE_PREDAUX 12
+// A numeral applied to its first argument, True applied to its first one
+#define NATIVE_ITER 13
+#define NATIVE_SELECT 14
+// Sum by its own iteration, which only becomes `n` once both are numerals
+#define NATIVE_ADD 15
+
+size_t nativeArity[] = { 0, 0, 0, 0, 1, 2, 2, 1, 1, 2, 2, 1, 0, 2, 2, 2 };
+
+typedef struct {
+    byte kind;
+    char *pattern;
+} nativePattern;
+
+nativePattern nativePatterns[] = {
+    { NATIVE_TRUE,    "LL1" },
+    { NATIVE_SUCC,    "LLL@1@@210" },          // λn.λs.λz.s (n s z)
+    { NATIVE_SUCC,    "LLL@@21@10" },          // λn.λs.λz.n s (s z)
+    { NATIVE_SUM,     "LL@@1S0" },             // λm.λn.m Succ n
+    { NATIVE_ADD,     "LLLL@@31@@210" },       // λm.λn.λs.λz.m s (n s z)
+    { NATIVE_MUL,     "LLL@2@10" },            // λm.λn.λs.m (n s)
+    { NATIVE_PREDAUX, "LL@@0@S@1T@1T" },       // λp.λz.z (Succ (p True)) (p True)
+    { NATIVE_PREDAUX, "LL@@0LL@1@@@3T10@1T" }, // the same with Succ reduced away
+    { NATIVE_PRED,    "L@@@0AL@@0FFF" },       // λn.n PredAux (λz.z Zero Zero) False
+    { NATIVE_PRED,    "LLL@@@2LL@0@13L1L0" },  // λn.λf.λx.n (λg.λh.h (g f)) (λu.x) (λu.u)
+    { NATIVE_ISZERO,  "L@@@0FNF" },            // λn.n False Not False
+    { NATIVE_ISZERO,  "L@@0LFT" },             // λn.n (λx.False) True
+    { NATIVE_AND,     "LL@@10F" },             // λx.λy.x y False
+    { NATIVE_AND,     "LL@@101" },             // λx.λy.x y x
+    { NATIVE_OR,      "LL@@1T0" },             // λx.λy.x True y
+    { NATIVE_OR,      "LL@@110" },             // λx.λy.x x y
+    { NATIVE_NOT,     "L@@0FT" },              // λx.x False True
+};
+
+// Kind of every shared term (0 until it is first asked for) and its value
+// if it is a numeral, on the heap
+_Thread_local byte *nativeKinds = NULL;
+_Thread_local uint64_t *nativeNums = NULL;
+_Thread_local refId nativeCap = 0;
+
+_Thread_local int64_t nativeOps = 0;
+
+// Reads a numeral at `data`, setting `next` past it
+bool nativeNumeral(byte *data, uint64_t *num, byte **next) {
+    if(*(exprType *)data != EXPR_FUN) return false;
+    data += dbNodeLen(data);
+    if(*(exprType *)data != EXPR_FUN) return false;
+    data += dbNodeLen(data);
+
+    uint64_t n = 0;
+    while(*(exprType *)data == EXPR_APP) {
+        data += dbNodeLen(data);
+        if(!isBind(*(exprType *)data) || dbIndex(data) != 1) return false;
+        data += dbNodeLen(data);
+        n++;
+    }
+    if(!isBind(*(exprType *)data) || dbIndex(data) != 0) return false;
+
+    *num = n;
+    *next = data + dbNodeLen(data);
+    return true;
+}
+
+bool nativeIsTrue(byte *data) {
+    if(*(exprType *)data != EXPR_FUN) return false;
+    data += dbNodeLen(data);
+    if(*(exprType *)data != EXPR_FUN) return false;
+    data += dbNodeLen(data);
+    return isBind(*(exprType *)data) && dbIndex(data) == 1;
+}
+
+byte nativeKind(refId id, uint64_t *num);
+
+// Matches one subterm of `pattern` at `data`, moving both past it
+bool nativeMatch(char **pattern, byte **data) {
+    char c = *(*pattern)++;
+    byte *d = *data;
+    exprType type = *(exprType *)d;
+
+    if(c == 'L') {
+        if(type != EXPR_FUN) return false;
+        *data += dbNodeLen(d);
+        return nativeMatch(pattern, data);
+    }
+    if(c == '@') {
+        if(type != EXPR_APP) return false;
+        *data += dbNodeLen(d);
+        return nativeMatch(pattern, data) && nativeMatch(pattern, data);
+    }
+    if(c >= '0' && c <= '9') {
+        if(!isBind(type) || dbIndex(d) != (bindt)(c - '0')) return false;
+        *data += dbNodeLen(d);
+        return true;
+    }
+
+    byte kind = NATIVE_NONE;
+    if(false) {}
+    else if(c == 'S') kind = NATIVE_SUCC;
+    else if(c == 'T') kind = NATIVE_TRUE;
+    else if(c == 'F') kind = NATIVE_NUM;
+    else if(c == 'N') kind = NATIVE_NOT;
+    else if(c == 'A') kind = NATIVE_PREDAUX;
+
+    uint64_t num = 0;
+    if(type == EXPR_REF) {
+        *data += dbNodeLen(d);
+        return nativeKind(readField(refId, d + sizeof(exprType)), &num) == kind && (kind != NATIVE_NUM || num == 0);
+    }
+    if(kind == NATIVE_NUM) {
+        return nativeNumeral(d, &num, data) && num == 0;
+    }
+
+    for(size_t i = 0; i < sizeof(nativePatterns) / sizeof(nativePattern); i++) {
+        if(nativePatterns[i].kind != kind) continue;
+
+        char *p = nativePatterns[i].pattern;
+        byte *at = d;
+        if(nativeMatch(&p, &at) && *p == '\0') {
+            *data = at;
+            return true;
+        }
+    }
+    return false;
+}
+
+// What the shared term `id` is, worked out the first time it is asked for.
+// Shared terms only mention earlier ones, so this always terminates
+byte nativeKind(refId id, uint64_t *num) {
+    if(id >= nativeCap) {
+        refId ncap = sharedCount;
+        nativeKinds = Realloc(nativeKinds, ncap * sizeof(byte));
+        nativeNums = Realloc(nativeNums, ncap * sizeof(uint64_t));
+        memset(nativeKinds + nativeCap, 0, (ncap - nativeCap) * sizeof(byte));
+        nativeCap = ncap;
+    }
+
+    if(nativeKinds[id] == 0) {
+        expr canon = sharedTable[id].canon;
+        byte *end = canon.data + canon.len;
+        byte *next = NULL;
+        nativeKinds[id] = NATIVE_NONE;
+        nativeNums[id] = 0;
+
+        if(nativeNumeral(canon.data, &nativeNums[id], &next) && next == end) {
+            nativeKinds[id] = NATIVE_NUM;
+        }
+        for(size_t i = 0; i < sizeof(nativePatterns) / sizeof(nativePattern) && nativeKinds[id] == NATIVE_NONE; i++) {
+            char *p = nativePatterns[i].pattern;
+            byte *at = canon.data;
+            if(nativeMatch(&p, &at) && *p == '\0' && at == end) nativeKinds[id] = nativePatterns[i].kind;
+        }
+    }
+
+    *num = nativeNums[id];
+    return nativeKinds[id];
+}
+
+// ==================
+// NORMALIZATION BY EVALUATION
+// ==================
+
+// EVAL_NBE compiles the term once into a tree of code and runs that tree into
+// a semantic domain: functions are closures, applications that can't reduce
+// are neutral terms. The normal form is then quoted back, applying every
+// function to a fresh variable. Arguments are passed as memoized thunks, so
+// YC works and nothing is evaluated twice. Shared terms are compiled once and
+// kept; their values are per evaluation. The code is run by a machine with
+// an explicit stack of frames like the one of CALL BY NEED, so a long chain
+// of thunks forcing each other doesn't grow the C stack
+//
+// EVAL_NATIVE is the same machine with nbeNative set: shared terms and
+// written out numerals NATIVE NUMERALS recognizes become NUM, TRUE and
+// NATIVE values, and an operator applied to numbers or booleans is one
+// machine operation (counted as a beta step). A numeral applied to two
+// arguments is a loop, strict for an impure function and otherwise building
+// the same thunks the numeral would. Anything else a native value meets gets
+// the term it stands for: only then is a numeral built. An operator only
+// runs an argument that normal order would run first anyway (the one the
+// boolean operators and IsZero start by applying); any other argument has
+// to be a value already, or the operator is expanded and its definition
+// decides, so a diverging argument that would have been dropped never runs
+
+typedef struct nbeValue nbeValue;
+typedef struct nbeEnv nbeEnv;
+
+#define NBE_CODE_FUN 0
+#define NBE_CODE_APP 1
+#define NBE_CODE_VAR 2
+#define NBE_CODE_REF 3
+#define NBE_CODE_CONST 4
+
+// FUN has its body in `lhs`, APP its function and argument in `lhs` and
+// `rhs`. VAR is a de Bruijn index and REF a refId, both in `index`. CONST and
+// a written out numeral or True (a FUN) have their value next to the code
+typedef struct nbeCode {
+    byte kind;
+    struct nbeCode *lhs;
+    struct nbeCode *rhs;
+    size_t index;
+    nbeValue *value;
+} nbeCode;
+
+#define NBE_THUNK 0
+#define NBE_BUSY 1
+#define NBE_FUN 2
+#define NBE_VAR 3
+#define NBE_NEUTRAL 4
+#define NBE_VAL 5
+#define NBE_IMPURE 6
+#define NBE_NUM 7
+#define NBE_TRUE 8
+#define NBE_NATIVE 9
+
+// THUNK and FUN are code + environment (the body, for a FUN), VAR is a
+// variable with its binder, NEUTRAL is `head` applied to `arg`. VAL and
+// IMPURE point at their node. `ref` is the shared term it stands for, + 1.
+// NUM holds a numeral in `num`; NATIVE is the operator `op` applied to `num`
+// arguments, the last one in `arg` and the rest in `head`
+struct nbeValue {
+    byte kind;
+    byte op;
+    uint64_t num;
+    refId ref;
+    bindt bind;
+    nbeCode *code;
+    nbeEnv *env;
+    nbeValue *head;
+    nbeValue *arg;
+    byte *data;
+};
+
+struct nbeEnv {
+    nbeValue *value;
+    nbeEnv *next;
+};
+
+// What the value being returned goes to: an argument `arg` to apply it to, a
+// thunk `value` to overwrite with it, or the impure function `value` it is
+// the argument of. The rest wait on a native operation: ITERATE is the
+// numeral `num` applied to the function being returned and to `arg`, REPEAT
+// applies the impure function `value` `num` more times (at 0 it passes the
+// value on), and OPERATE runs the operator `value` applied to `arg` once its
+// first argument is a value
+#define NBE_ARG 0
+#define NBE_UPDATE 1
+#define NBE_CALL 2
+#define NBE_ITERATE 3
+#define NBE_REPEAT 4
+#define NBE_OPERATE 5
+
+typedef struct {
+    byte kind;
+    uint64_t num;
+    nbeValue *value;
+    nbeValue *arg;
+} nbeFrame;
+
+typedef struct {
+    nbeFrame *items;
+    size_t len;
+    size_t cap;
+} nbeStack;
+
+static inline void nspush(nbeStack *stack, nbeFrame frame) {
+    if(stack->len == stack->cap) {
+        nbeFrame *nitems = termAlloc((stack->cap * 2 + 1) * sizeof(nbeFrame));
+        memcpy(nitems, stack->items, stack->len * sizeof(nbeFrame));
+        termFree(stack->items);
+        stack->items = nitems;
+        stack->cap = stack->cap * 2 + 1;
+    }
+
+    stack->items[stack->len] = frame;
+    (stack->len)++;
+}
+
+#define nsinit (256)
+#define mkns() ((nbeStack){ .items = termAlloc(nsinit * sizeof(nbeFrame)), .len = 0, .cap = nsinit })
+
+// Compiled shared terms stay in nbeCodeArena, values go to nbeArena which
+// is reset after every evaluation
+_Thread_local arena nbeArena = {0};
+_Thread_local arena nbeCodeArena = {0};
+_Thread_local nbeCode **nbeShared = NULL;
+_Thread_local refId nbeSharedCap = 0;
+_Thread_local nbeValue **nbeRefs = NULL;
+_Thread_local bindList nbeFree = {0};
+_Thread_local nbeStack nbeFrames = {0};
+_Thread_local bool nbeNative = false;
+
+nbeValue *nbeNew(byte kind) {
+    nbeValue *v = arenaAlloc(&nbeArena, sizeof(nbeValue));
+    memset(v, 0, sizeof(nbeValue));
+    v->kind = kind;
+    return v;
+}
+
+nbeValue *nbeNeutral(nbeValue *head, nbeValue *arg) {
+    nbeValue *v = nbeNew(NBE_NEUTRAL);
+    v->head = head;
+    v->arg = arg;
+    return v;
+}
+
+nbeEnv *nbeBind(nbeValue *value, nbeEnv *next) {
+    nbeEnv *env = arenaAlloc(&nbeArena, sizeof(nbeEnv));
+    env->value = value;
+    env->next = next;
+    return env;
+}
+
+nbeValue *nbeRef(refId id);
+nbeCode *nbeCompile(expr db, arena *a);
+
+nbeValue *nbeLookup(nbeEnv *env, size_t index) {
+    for(; env != NULL; env = env->next) {
+        if(index == 0) return env->value;
+        index--;
+    }
+
+    nbeValue *v = nbeNew(NBE_VAR);
+    v->bind = nbeFree.items[index];
+    return v;
+}
+
+nbeValue *nbeFun(nbeCode *code, nbeEnv *env) {
+    // A written out numeral or True has its native value next to the code
+    if(nbeNative && code->value != NULL) return code->value;
+
+    nbeValue *v = nbeNew(NBE_FUN);
+    v->code = code->lhs;
+    v->env = env;
+    return v;
+}
+
+// What gets passed for an argument: variables, shared terms and constants
+// are already values or thunks, anything else becomes a new thunk
+nbeValue *nbeArg(nbeCode *code, nbeEnv *env) {
+    if(false) {}
+    else if(code->kind == NBE_CODE_VAR)   return nbeLookup(env, code->index);
+    else if(code->kind == NBE_CODE_REF)   return nbeRef(code->index);
+    else if(code->kind == NBE_CODE_CONST) return code->value;
+    else if(code->kind == NBE_CODE_FUN)   return nbeFun(code, env);
+
+    nbeValue *v = nbeNew(NBE_THUNK);
+    v->code = code;
+    v->env = env;
+    return v;
+}
+
+// Starts forcing `v` if it is a thunk, otherwise returns it
+nbeValue *nbeStart(nbeValue *v, nbeCode **code, nbeEnv **env) {
+    if(v->kind == NBE_BUSY) {
+        printf("Infinite loop: a thunk needs its own value\n");
+        exit(1);
+    }
+    if(v->kind != NBE_THUNK) return v;
+
+    nspush(&nbeFrames, (nbeFrame){ .kind = NBE_UPDATE, .value = v });
+    v->kind = NBE_BUSY;
+    if(v->ref != 0) runStats.sharedCopies++;
+    *code = v->code;
+    *env = v->env;
+    return NULL;
+}
+
+nbeCode *nbeSharedCode(refId id) {
+    if(id >= nbeSharedCap) {
+        refId ncap = sharedCount;
+        nbeShared = Realloc(nbeShared, ncap * sizeof(nbeCode *));
+        memset(nbeShared + nbeSharedCap, 0, (ncap - nbeSharedCap) * sizeof(nbeCode *));
+        nbeSharedCap = ncap;
+    }
+    if(nbeShared[id] == NULL) nbeShared[id] = nbeCompile(sharedTable[id].canon, &nbeCodeArena);
+    return nbeShared[id];
+}
+
+nbeValue *nbeRef(refId id) {
+    if(nbeRefs[id] != NULL) return nbeRefs[id];
+
+    nbeValue *v;
+    uint64_t num = 0;
+    byte kind = nbeNative ? nativeKind(id, &num) : NATIVE_NONE;
+
+    if(false) {}
+    else if(kind == NATIVE_NUM) {
+        v = nbeNew(NBE_NUM);
+        v->num = num;
+    }
+    else if(kind == NATIVE_TRUE) {
+        v = nbeNew(NBE_TRUE);
+    }
+    else if(kind != NATIVE_NONE && kind != NATIVE_PREDAUX) {
+        v = nbeNew(NBE_NATIVE);
+        v->op = kind;
+    }
+    else {
+        v = nbeNew(NBE_THUNK);
+        v->code = nbeSharedCode(id);
+    }
+
+    v->ref = id + 1;
+    nbeRefs[id] = v;
+    return v;
+}
+
+nbeValue *nbeNativeNew(byte kind, byte op, uint64_t num) {
+    nbeValue *v = nbeNew(kind);
+    v->op = op;
+    v->num = num;
+    return v;
+}
+
+nbeValue *nbeBool(bool b) {
+    return b ? nbeNew(NBE_TRUE) : nbeNativeNew(NBE_NUM, 0, 0);
+}
+
+// The term a native value with no arguments stands for, as a function whose
+// outermost binder is entered directly, or it would be recognized again
+nbeValue *nbeNativeTerm(nbeValue *v) {
+    nbeCode *code;
+    if(v->ref != 0) {
+        code = nbeSharedCode(v->ref - 1);
+    }
+    else {
+        uint64_t n = v->kind == NBE_NUM ? v->num : 0;
+        size_t len = 2 * sizeof(exprType) + n * (sizeof(exprType) + BIND_LEN) + BIND_LEN;
+        byte *data = termAlloc(len);
+        byte *p = data;
+
+        *(exprType *)p = EXPR_FUN; p += sizeof(exprType);
+        *(exprType *)p = EXPR_FUN; p += sizeof(exprType);
+        for(uint64_t i = 0; i < n; i++) {
+            *(exprType *)p = EXPR_APP; p += sizeof(exprType);
+            *(exprType *)p = EXPR_BIND;
+            writeField(bindt, p + sizeof(exprType), 1);
+            p += BIND_LEN;
+        }
+        *(exprType *)p = EXPR_BIND;
+        writeField(bindt, p + sizeof(exprType), v->kind == NBE_TRUE ? 1 : 0);
+
+        code = nbeCompile((expr){ .data = data, .len = len }, &nbeArena);
+    }
+
+    nbeValue *f = nbeNew(NBE_FUN);
+    f->code = code->lhs;
+    return f;
+}
+
+// Pushes the arguments a native value was applied to and returns the term
+// it stands for, so the machine applies one to the other
+nbeValue *nbeNativeUnfold(nbeValue *v) {
+    for(; v->kind == NBE_NATIVE && v->head != NULL; v = v->head) {
+        nspush(&nbeFrames, (nbeFrame){ .kind = NBE_ARG, .arg = v->arg });
+    }
+    return nbeNativeTerm(v);
+}
+
+// Whether `v` is evaluated already, so looking at it runs nothing
+#define nbeReady(v) ((v)->kind != NBE_THUNK && (v)->kind != NBE_BUSY)
+
+// The operator `op` on its arguments, or NULL if they aren't the numbers or
+// booleans it works on natively, or aren't values yet. A result that is an
+// argument may still have to be forced. False is the numeral 0
+nbeValue *nbeNativeCompute(byte op, nbeValue **args) {
+    nbeValue *a = args[0];
+    if(!nbeReady(a)) return NULL;
+
+    bool aBool = a->kind == NBE_TRUE || (a->kind == NBE_NUM && a->num == 0);
+
+    if(false) {}
+    else if(op == NATIVE_AND && aBool) return a->kind == NBE_TRUE ? args[1] : a;
+    else if(op == NATIVE_OR && aBool)  return a->kind == NBE_TRUE ? a : args[1];
+    else if(op == NATIVE_NOT && aBool) return nbeBool(a->kind != NBE_TRUE);
+    else if(a->kind != NBE_NUM)        return NULL;
+    else if(op == NATIVE_SUCC)         return nbeNativeNew(NBE_NUM, 0, a->num + 1);
+    else if(op == NATIVE_PRED)         return nbeNativeNew(NBE_NUM, 0, a->num > 0 ? a->num - 1 : 0);
+    else if(op == NATIVE_ISZERO)       return nbeBool(a->num == 0);
+    else if(op == NATIVE_MUL && a->num == 0) return a;
+    else if(op == NATIVE_SUM && a->num == 0) return args[1];
+    else if(op == NATIVE_SUM || op == NATIVE_ADD || op == NATIVE_MUL) {
+        nbeValue *b = args[1];
+        if(!nbeReady(b) || b->kind != NBE_NUM) return NULL;
+        return nbeNativeNew(NBE_NUM, 0, op == NATIVE_MUL ? a->num * b->num : a->num + b->num);
+    }
+
+    return NULL;
+}
+
+// The numeral `n` applied to the function `g` (a value) and `x`: one call
+// after another for an impure function, arithmetic for Succ and Pred, and
+// otherwise a chain of thunks like the numeral's own body would build
+nbeCode nbeIterFun = { .kind = NBE_CODE_VAR, .index = 1 };
+nbeCode nbeIterArg = { .kind = NBE_CODE_VAR, .index = 0 };
+nbeCode nbeIterApp = { .kind = NBE_CODE_APP, .lhs = &nbeIterFun, .rhs = &nbeIterArg };
+
+nbeValue *nbeIterate(uint64_t n, nbeValue *g, nbeValue *x, nbeCode **code, nbeEnv **env) {
+    if(g->kind == NBE_IMPURE) {
+        nspush(&nbeFrames, (nbeFrame){ .kind = NBE_REPEAT, .num = n, .value = g });
+        return x;
+    }
+    if(g->kind == NBE_NATIVE && g->head == NULL && (g->op == NATIVE_SUCC || g->op == NATIVE_PRED) && nbeReady(x) && x->kind == NBE_NUM) {
+        if(g->op == NATIVE_SUCC) return nbeNativeNew(NBE_NUM, 0, x->num + n);
+        return nbeNativeNew(NBE_NUM, 0, x->num > n ? x->num - n : 0);
+    }
+
+    nbeEnv *genv = nbeBind(g, NULL);
+    for(uint64_t i = 0; i < n; i++) {
+        nbeValue *t = nbeNew(NBE_THUNK);
+        t->code = &nbeIterApp;
+        t->env = nbeBind(x, genv);
+        x = t;
+    }
+    return nbeStart(x, code, env);
+}
+
+// `f` applied to `arg`, where `f` is a native value: collects arguments
+// until the operator has all of them, then runs it. Like nbeStart, returns
+// NULL when it leaves code to run instead
+nbeValue *nbeApplyNative(nbeValue *f, nbeValue *arg, nbeCode **code, nbeEnv **env) {
+    byte op = f->op;
+    if(f->kind == NBE_NUM)  op = NATIVE_ITER;
+    if(f->kind == NBE_TRUE) op = NATIVE_SELECT;
+    size_t count = f->kind == NBE_NATIVE ? f->num + 1 : 1;
+
+    if(count < nativeArity[op]) {
+        nbeValue *p = nbeNativeNew(NBE_NATIVE, op, count);
+        p->head = f;
+        p->arg = arg;
+        return p;
+    }
+
+    nbeValue *args[2] = { count == 2 ? f->arg : arg, arg };
+    bool strict = op == NATIVE_AND || op == NATIVE_OR || op == NATIVE_NOT || op == NATIVE_ISZERO;
+
+    if(strict && !nbeReady(args[0])) {
+        nspush(&nbeFrames, (nbeFrame){ .kind = NBE_OPERATE, .value = f, .arg = arg });
+        return nbeStart(args[0], code, env);
+    }
+
+    if(op == NATIVE_ITER) {
+        runStats.betaSteps++;
+        nativeOps++;
+        if(f->head->num == 0) return nbeStart(arg, code, env);
+        nspush(&nbeFrames, (nbeFrame){ .kind = NBE_ITERATE, .num = f->head->num, .arg = arg });
+        return nbeStart(f->arg, code, env);
+    }
+
+    nbeValue *r = op == NATIVE_SELECT ? f->arg : nbeNativeCompute(op, args);
+    if(r == NULL) {
+        nspush(&nbeFrames, (nbeFrame){ .kind = NBE_ARG, .arg = arg });
+        return nbeNativeUnfold(f);
+    }
+
+    runStats.betaSteps++;
+    nativeOps++;
+    return nbeStart(r, code, env);
+}
+
+// Runs `code` in `env`, or returns `v` if it isn't NULL, until the frames
+// above `base` are used up
+nbeValue *nbeRun(size_t base, nbeValue *v, nbeCode *code, nbeEnv *env) {
+    while(true) {
+        if(v == NULL) {
+            if(false) {}
+            else if(code->kind == NBE_CODE_APP) {
+                nspush(&nbeFrames, (nbeFrame){ .kind = NBE_ARG, .arg = nbeArg(code->rhs, env) });
+                code = code->lhs;
+            }
+            else if(code->kind == NBE_CODE_VAR) v = nbeStart(nbeLookup(env, code->index), &code, &env);
+            else if(code->kind == NBE_CODE_REF) v = nbeStart(nbeRef(code->index), &code, &env);
+            else                                v = nbeArg(code, env);
+            continue;
+        }
+
+        if(nbeFrames.len == base) return v;
+        nbeFrame frame = nbeFrames.items[--nbeFrames.len];
+
+        if(false) {}
+        else if(frame.kind == NBE_UPDATE) {
+            refId ref = v->ref != 0 ? v->ref : frame.value->ref;
+            *frame.value = *v;
+            frame.value->ref = ref;
+            v = frame.value;
+        }
+        else if(frame.kind == NBE_ARG && v->kind >= NBE_NUM) {
+            v = nbeApplyNative(v, frame.arg, &code, &env);
+        }
+        else if(frame.kind == NBE_ARG && v->kind == NBE_FUN) {
+            runStats.betaSteps++;
+            env = nbeBind(frame.arg, v->env);
+            code = v->code;
+            v = NULL;
+        }
+        else if(frame.kind == NBE_ARG && v->kind == NBE_IMPURE) {
+            nspush(&nbeFrames, (nbeFrame){ .kind = NBE_CALL, .value = v });
+            v = nbeStart(frame.arg, &code, &env);
+        }
+        else if(frame.kind == NBE_ARG) {
+            v = nbeNeutral(v, frame.arg);
+        }
+        else if(frame.kind == NBE_CALL && v->kind == NBE_VAL) {
+            impureFunpt imfun = impureAt(frame.value->data + sizeof(exprType));
+            expr result = imfun(v->data, impureValLen(v->data));
+            runStats.impureCalls++;
+
+            if(*(exprType *)result.data == EXPR_IMPURE_VAL) {
+                v = nbeNew(NBE_VAL);
+                v->data = result.data;
+            }
+            else {
+                code = nbeCompile(toDeBruijn(result, NULL), &nbeArena);
+                env = NULL;
+                v = NULL;
+            }
+        }
+        else if(frame.kind == NBE_CALL) {
+            v = nbeNeutral(frame.value, v);
+        }
+        else if(frame.kind == NBE_ITERATE) {
+            v = nbeIterate(frame.num, v, frame.arg, &code, &env);
+        }
+        else if(frame.kind == NBE_REPEAT && frame.num > 0) {
+            nspush(&nbeFrames, (nbeFrame){ .kind = NBE_REPEAT, .num = frame.num - 1, .value = frame.value });
+            nspush(&nbeFrames, (nbeFrame){ .kind = NBE_ARG, .arg = v });
+            v = frame.value;
+        }
+        else if(frame.kind == NBE_OPERATE) {
+            v = nbeApplyNative(frame.value, frame.arg, &code, &env);
+        }
+    }
+}
+
+nbeValue *nbeForce(nbeValue *v) {
+    if(nbeReady(v)) return v;
+
+    size_t base = nbeFrames.len;
+    nbeCode *code = NULL;
+    nbeEnv *env = NULL;
+    v = nbeStart(v, &code, &env);
+    return nbeRun(base, v, code, env);
+}
+
+// Runs the body of the function `f` with `arg` bound
+nbeValue *nbeEnter(nbeValue *f, nbeValue *arg) {
+    return nbeRun(nbeFrames.len, NULL, f->code, nbeBind(arg, f->env));
+}
+
+// The value of the term a native value stands for
+nbeValue *nbeNativeExpand(nbeValue *v) {
+    size_t base = nbeFrames.len;
+    return nbeRun(base, nbeNativeUnfold(v), NULL, NULL);
+}
+
+// Compiles a de Bruijn form into `a`, in one pre-order pass like
+// graphFromDeBruijn. Scratch space comes from the current arena
+nbeCode *nbeCompile(expr db, arena *a) {
+    size_t cap = 64;
+    size_t len = 0;
+    nbeCode **open = termAlloc(cap * sizeof(nbeCode *));
+    nbeCode *root = NULL;
+
+    for(byte *data = db.data; data < db.data + db.len; data += dbNodeLen(data)) {
+        exprType type = *(exprType *)data;
+        nbeCode *c = arenaAlloc(a, sizeof(nbeCode));
+        memset(c, 0, sizeof(nbeCode));
+
+        uint64_t num;
+        byte *next;
+
+        if(false) {}
+        else if(type == EXPR_FUN && nativeNumeral(data, &num, &next)) {
+            c->kind = NBE_CODE_FUN;
+            c->value = arenaAlloc(a, sizeof(nbeValue));
+            memset(c->value, 0, sizeof(nbeValue));
+            c->value->kind = NBE_NUM;
+            c->value->num = num;
+        }
+        else if(type == EXPR_FUN && nativeIsTrue(data)) {
+            c->kind = NBE_CODE_FUN;
+            c->value = arenaAlloc(a, sizeof(nbeValue));
+            memset(c->value, 0, sizeof(nbeValue));
+            c->value->kind = NBE_TRUE;
+        }
+        else if(type == EXPR_FUN) c->kind = NBE_CODE_FUN;
+        else if(type == EXPR_APP) c->kind = NBE_CODE_APP;
+        else if(isBind(type)) {
+            c->kind = NBE_CODE_VAR;
+            c->index = dbIndex(data);
+        }
+        else if(type == EXPR_REF) {
+            c->kind = NBE_CODE_REF;
+            c->index = readField(refId, data + sizeof(exprType));
+        }
+        else {
+            // Constants are made once, next to the code
+            size_t nlen = dbNodeLen(data);
+            c->kind = NBE_CODE_CONST;
+            c->value = arenaAlloc(a, sizeof(nbeValue));
+            memset(c->value, 0, sizeof(nbeValue));
+            c->value->kind = type == EXPR_IMPURE_VAL ? NBE_VAL : NBE_IMPURE;
+            c->value->data = arenaAlloc(a, nlen);
+            memcpy(c->value->data, data, nlen);
+        }
+
+        if(len == 0)                                       root = c;
+        else if(open[len - 1]->kind == NBE_CODE_FUN)       open[len - 1]->lhs = c;
+        else if(open[len - 1]->lhs == NULL)                open[len - 1]->lhs = c;
+        else                                               open[len - 1]->rhs = c;
+
+        while(len > 0) {
+            nbeCode *top = open[len - 1];
+            if(top->kind == NBE_CODE_APP && top->rhs == NULL) break;
+            if(top->kind == NBE_CODE_FUN && top->lhs == NULL) break;
+            len--;
+        }
+
+        if(dbChildren(type) > 0) {
+            if(len == cap) {
+                nbeCode **nopen = termAlloc(cap * 2 * sizeof(nbeCode *));
+                memcpy(nopen, open, len * sizeof(nbeCode *));
+                open = nopen;
+                cap *= 2;
+            }
+            open[len++] = c;
+        }
+    }
+
+    return root;
+}
+
+// Quotes `root` back to named form in nbeArena, pre-order with an explicit
+// stack. Each function is applied to a fresh variable to get at its body;
+// shared terms in normal form go back in as an EXPR_REF
+expr nbeQuote(nbeValue *root) {
+    size_t pendingCap = 64;
+    size_t pendingLen = 0;
+    nbeValue **pending = termAlloc(pendingCap * sizeof(nbeValue *));
+    pending[pendingLen++] = root;
+
+    size_t cap = 256;
+    expr out = { .data = termAlloc(cap), .len = 0, .aux = true };
+
+    while(pendingLen > 0) {
+        nbeValue *v = pending[--pendingLen];
+        bool asRef = v->ref != 0 && sharedTable[v->ref - 1].normal;
+        if(!asRef) v = nbeForce(v);
+        while(!asRef && v->kind == NBE_NATIVE) v = nbeNativeExpand(v);
+
+        size_t len = REF_LEN;
+        if(asRef)                        len = REF_LEN;
+        else if(v->kind == NBE_NUM)      len = 2 * FUN_LEN + v->num * (sizeof(exprType) + BIND_LEN) + BIND_LEN;
+        else if(v->kind == NBE_TRUE)     len = 2 * FUN_LEN + BIND_LEN;
+        else if(v->kind == NBE_FUN)      len = FUN_LEN;
+        else if(v->kind == NBE_VAR)      len = BIND_LEN;
+        else if(v->kind == NBE_NEUTRAL)  len = sizeof(exprType);
+        else if(v->kind == NBE_VAL)      len = impureValLen(v->data);
+        else if(v->kind == NBE_IMPURE)   len = IMPURE_FUN_LEN;
+
+        if(out.len + len > cap) {
+            while(out.len + len > cap) cap *= 2;
+            byte *ndata = termAlloc(cap);
+            memcpy(ndata, out.data, out.len);
+            out.data = ndata;
+        }
+        byte *data = out.data + out.len;
+        out.len += len;
+
+        if(pendingLen + 2 > pendingCap) {
+            nbeValue **npending = termAlloc(pendingCap * 2 * sizeof(nbeValue *));
+            memcpy(npending, pending, pendingLen * sizeof(nbeValue *));
+            pending = npending;
+            pendingCap *= 2;
+        }
+
+        if(false) {}
+        else if(asRef) {
+            *(exprType *)data = EXPR_REF;
+            writeField(refId, data + sizeof(exprType), v->ref - 1);
+        }
+        else if(v->kind == NBE_FUN) {
+            var(bind);
+            nbeValue *fresh = nbeNew(NBE_VAR);
+            fresh->bind = bind;
+
+            *(exprType *)data = EXPR_FUN;
+            writeField(bindt, data + sizeof(exprType), bind);
+            pending[pendingLen++] = nbeEnter(v, fresh);
+        }
+        else if(v->kind == NBE_NUM || v->kind == NBE_TRUE) {
+            var(s);
+            var(z);
+            *(exprType *)data = EXPR_FUN;
+            writeField(bindt, data + sizeof(exprType), s);
+            data += FUN_LEN;
+            *(exprType *)data = EXPR_FUN;
+            writeField(bindt, data + sizeof(exprType), z);
+            data += FUN_LEN;
+
+            uint64_t n = v->kind == NBE_NUM ? v->num : 0;
+            for(uint64_t i = 0; i < n; i++) {
+                *(exprType *)data = EXPR_APP;
+                *(exprType *)(data + sizeof(exprType)) = EXPR_BIND;
+                writeField(bindt, data + 2 * sizeof(exprType), s);
+                data += sizeof(exprType) + BIND_LEN;
+            }
+            *(exprType *)data = EXPR_BIND;
+            writeField(bindt, data + sizeof(exprType), v->kind == NBE_TRUE ? s : z);
+        }
+        else if(v->kind == NBE_VAR) {
+            *(exprType *)data = EXPR_BIND;
+            writeField(bindt, data + sizeof(exprType), v->bind);
+        }
+        else if(v->kind == NBE_NEUTRAL) {
+            *(exprType *)data = EXPR_APP;
+            pending[pendingLen++] = v->arg;
+            pending[pendingLen++] = v->head;
+        }
+        else {
+            memcpy(data, v->data, len);
+        }
+    }
+
+    return out;
+}
+
+void evaluateNbe(expr *e) {
+    int64_t steps = runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies;
+    arena *prev = arenaEnter(&nbeArena);
+
+    nbeFree = mkbl();
+    nbeFrames = mkns();
+    nbeRefs = termAlloc((sharedCount + 1) * sizeof(nbeValue *));
+    memset(nbeRefs, 0, (sharedCount + 1) * sizeof(nbeValue *));
+
+    depthStack stack = mkds();
+    bindt *binds = termAlloc((e->len / FUN_LEN + 1) * sizeof(bindt));
+    byte *code = termAlloc(e->len);
+    size_t len = deBruijnInto(*e, code, binds, &stack, NULL, &nbeFree);
+
+    nbeValue *root = nbeArg(nbeCompile((expr){ .data = code, .len = len }, &nbeArena), NULL);
+    expr nf = nbeQuote(root);
+
+    arenaLeave(prev);
+
+    if(runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies > steps) {
+        runStats.bytesMoved += nf.len;
+        if(nf.len > runStats.peakLen) runStats.peakLen = nf.len;
+
+        termFree(e->data);
+        e->data = termAlloc(nf.len);
+        e->len = nf.len;
+        memcpy(e->data, nf.data, nf.len);
+    }
+
+    arenaReset(&nbeArena);
+}
+
+void evaluateNative(expr *e) {
+    nbeNative = true;
+    evaluateNbe(e);
+    nbeNative = false;
+}
+
+// ==================
+// INTERACTION NETS
+// ==================
+
+// EVAL_INET is an experimental optimal reduction backend, the abstract
+// algorithm without brackets: the term becomes an interaction net of λ, @,
+// labelled fan (DUP) and eraser agents, where a fan copies only what is
+// actually needed, one agent at a time, so work on a shared argument is done
+// once even under binders. It is only correct when fans with the same label
+// never end up copying each other (the stratified fragment). Every expansion
+// of a shared term gets fresh labels, which covers the demo, YC included, and
+// Church exponentiation. Outside of it the net tends to grow or interact
+// forever instead: a net that gets over INET_MAX_NODES agents or
+// INET_MAX_INTERACTIONS interactions, or into a shape a λ-term can't have,
+// is given up and the term goes to EVAL_NBE instead
+//
+// Readback gives up too on a variable that isn't under its λ, which is where
+// a fan without brackets most often leaves one. A variable moved under the
+// wrong λ that is still in scope isn't caught, so the result can be wrong
+// and EVAL_INET stays out of the benchmarks until it has brackets
+//
+// Reduction is lazy: only the active pairs the root depends on are reduced,
+// so YC still terminates where normal order does. The normal form is read
+// back by reducing to weak head normal form and applying every λ to a fresh
+// variable agent, like EVAL_NBE. A fan copying a stuck application is pushed
+// through it, which normal order can't avoid either
+
+#define INET_MAX_NODES (1 << 22)
+#define INET_MAX_INTERACTIONS (1 << 25)
+
+#define INET_FREE 0
+#define INET_ROOT 1
+#define INET_LAM 2
+#define INET_APP 3
+#define INET_DUP 4
+#define INET_ERA 5
+#define INET_VAR 6
+#define INET_VAL 7
+#define INET_OP 8
+#define INET_OPA 9
+#define INET_REF 10
+
+// A port is a node index and a slot: 0 is the principal port, LAM has body
+// and variable on 1 and 2, APP argument and result, DUP the two copies. OP is
+// an impure function, OPA one applied to the argument on its principal port,
+// its result on 1. `label` is the fan label, the binder of a VAR and the
+// shared term of a REF
+typedef struct {
+    byte kind;
+    bool stuck;
+    uint32_t ports[3];
+    bindt label;
+    byte *data;
+} inetNode;
+
+#define inetPort(n, s) (((n) << 2) | (s))
+#define inetNodeOf(p) ((p) >> 2)
+#define inetSlot(p) ((p) & 3)
+#define inetPeer(p) (inetNodes[inetNodeOf(p)].ports[inetSlot(p)])
+
+_Thread_local inetNode *inetNodes = NULL;
+_Thread_local uint32_t inetCount = 0;
+_Thread_local uint32_t inetCap = 0;
+_Thread_local uint32_t inetFreeList = 0;
+_Thread_local uint32_t inetLabel = 0;
+_Thread_local bool inetFailed = false;
+
+_Thread_local int64_t inetInteractions = 0;
+_Thread_local int64_t inetFallbacks = 0;
+
+// inetInteractions at which the current evaluation gives up
+_Thread_local int64_t inetBudget = 0;
+
+// Scratch space per evaluation, in inetArena
+_Thread_local arena inetArena = {0};
+_Thread_local bindList inetFree = {0};
+_Thread_local uint32_t *inetStack = NULL;
+_Thread_local size_t inetStackLen = 0;
+_Thread_local size_t inetStackCap = 0;
+
+static inline void inetLink(uint32_t a, uint32_t b) {
+    inetPeer(a) = b;
+    inetPeer(b) = a;
+}
+
+uint32_t inetArity(byte kind) {
+    if(kind == INET_LAM || kind == INET_APP || kind == INET_DUP) return 2;
+    if(kind == INET_OPA) return 1;
+    return 0;
+}
+
+uint32_t inetNew(byte kind) {
+    uint32_t n;
+    if(inetFreeList != 0) {
+        n = inetFreeList;
+        inetFreeList = inetNodes[n].ports[0];
+    }
+    else {
+        if(inetCount == inetCap) {
+            inetCap = inetCap * 2 + 1024;
+            inetNodes = Realloc(inetNodes, inetCap * sizeof(inetNode));
+        }
+        n = inetCount++;
+    }
+
+    memset(&inetNodes[n], 0, sizeof(inetNode));
+    inetNodes[n].kind = kind;
+    return n;
+}
+
+void inetDelete(uint32_t n) {
+    inetNodes[n].kind = INET_FREE;
+    inetNodes[n].ports[0] = inetFreeList;
+    inetFreeList = n;
+}
+
+void inetPush(uint32_t port) {
+    if(inetStackLen == inetStackCap) {
+        size_t ncap = inetStackCap * 2 + 64;
+        uint32_t *nitems = termAlloc(ncap * sizeof(uint32_t));
+        if(inetStackLen > 0) memcpy(nitems, inetStack, inetStackLen * sizeof(uint32_t));
+        inetStack = nitems;
+        inetStackCap = ncap;
+    }
+    inetStack[inetStackLen++] = port;
+}
+
+// Connects what was on the ports `x` and `y` of two agents that go away.
+// Wires between ports that go away are followed through the updates
+void inetJoin(uint32_t x, uint32_t y) {
+    uint32_t p = inetPeer(x);
+    uint32_t q = inetPeer(y);
+    if(p == y) return;
+    inetLink(p, q);
+}
+
+// Commutes `a` and `b`, meeting on their slots `ca` and `cb`: every other
+// port of `b` gets a copy of `a` and the other way around
+void inetCommute(uint32_t a, uint32_t ca, uint32_t b, uint32_t cb) {
+    uint32_t aOthers[2], bOthers[2];
+    uint32_t ka = 0, kb = 0;
+    for(uint32_t s = 0; s <= inetArity(inetNodes[a].kind); s++) if(s != ca) aOthers[ka++] = s;
+    for(uint32_t s = 0; s <= inetArity(inetNodes[b].kind); s++) if(s != cb) bOthers[kb++] = s;
+
+    uint32_t aCopies[2], bCopies[2];
+    for(uint32_t i = 0; i < kb; i++) {
+        aCopies[i] = inetNew(inetNodes[a].kind);
+        inetNodes[aCopies[i]].label = inetNodes[a].label;
+        inetNodes[aCopies[i]].data = inetNodes[a].data;
+    }
+    for(uint32_t j = 0; j < ka; j++) {
+        bCopies[j] = inetNew(inetNodes[b].kind);
+        inetNodes[bCopies[j]].label = inetNodes[b].label;
+        inetNodes[bCopies[j]].data = inetNodes[b].data;
+    }
+
+    for(uint32_t i = 0; i < kb; i++) {
+        for(uint32_t j = 0; j < ka; j++) {
+            inetLink(inetPort(aCopies[i], aOthers[j]), inetPort(bCopies[j], bOthers[i]));
+        }
+    }
+    for(uint32_t i = 0; i < kb; i++) inetLink(inetPort(aCopies[i], ca), inetPeer(inetPort(b, bOthers[i])));
+    for(uint32_t j = 0; j < ka; j++) inetLink(inetPort(bCopies[j], cb), inetPeer(inetPort(a, aOthers[j])));
+
+    inetDelete(a);
+    inetDelete(b);
+}
+
+void inetBeta(uint32_t app, uint32_t lam) {
+    inetJoin(inetPort(app, 1), inetPort(lam, 2));
+    inetJoin(inetPort(app, 2), inetPort(lam, 1));
+    inetDelete(app);
+    inetDelete(lam);
+}
+
+uint32_t inetCompile(expr db, uint32_t host);
+
+// Replaces the REF `n` by a fresh net of its shared term
+void inetExpand(uint32_t n) {
+    uint32_t host = inetPeer(inetPort(n, 0));
+    refId id = inetNodes[n].label;
+    inetDelete(n);
+    inetCompile(sharedTable[id].canon, host);
+    runStats.sharedCopies++;
+}
+
+// Rewrites the active pair `a`, `b`. Returns false if there is no rule for it
+bool inetInteract(uint32_t a, uint32_t b) {
+    byte ka = inetNodes[a].kind;
+    byte kb = inetNodes[b].kind;
+
+    if(kb == INET_DUP || kb == INET_ERA) {
+        uint32_t t = a; a = b; b = t;
+        byte kt = ka; ka = kb; kb = kt;
+    }
+    if(ka == INET_APP && kb != INET_APP) {
+        uint32_t t = a; a = b; b = t;
+        byte kt = ka; ka = kb; kb = kt;
+    }
+
+    if(false) {}
+    else if(ka == INET_DUP && kb == INET_DUP && inetNodes[a].label == inetNodes[b].label) {
+        inetJoin(inetPort(a, 1), inetPort(b, 1));
+        inetJoin(inetPort(a, 2), inetPort(b, 2));
+        inetDelete(a);
+        inetDelete(b);
+    }
+    else if(ka == INET_DUP || ka == INET_ERA) {
+        inetCommute(a, 0, b, 0);
+    }
+    else if(ka == INET_LAM && kb == INET_APP) {
+        inetBeta(b, a);
+        runStats.betaSteps++;
+    }
+    else if(ka == INET_REF && kb == INET_APP) {
+        inetExpand(a);
+    }
+    else if(ka == INET_OP && kb == INET_APP) {
+        uint32_t opa = inetNew(INET_OPA);
+        inetNodes[opa].data = inetNodes[a].data;
+        inetLink(inetPort(opa, 0), inetPeer(inetPort(b, 1)));
+        inetLink(inetPort(opa, 1), inetPeer(inetPort(b, 2)));
+        inetDelete(a);
+        inetDelete(b);
+    }
+    else if((ka == INET_VAL && kb == INET_OPA) || (ka == INET_OPA && kb == INET_VAL)) {
+        uint32_t opa = ka == INET_OPA ? a : b;
+        uint32_t val = ka == INET_OPA ? b : a;
+
+        impureFunpt imfun = impureAt(inetNodes[opa].data + sizeof(exprType));
+        expr result = imfun(inetNodes[val].data, impureValLen(inetNodes[val].data));
+        runStats.impureCalls++;
+
+        uint32_t host = inetPeer(inetPort(opa, 1));
+        inetDelete(opa);
+        inetDelete(val);
+
+        if(*(exprType *)result.data == EXPR_IMPURE_VAL) {
+            uint32_t n = inetNew(INET_VAL);
+            inetNodes[n].data = result.data;
+            inetLink(inetPort(n, 0), host);
+        }
+        else {
+            inetCompile(toDeBruijn(result, NULL), host);
+        }
+    }
+    else {
+        return false;
+    }
+
+    inetInteractions++;
+    return true;
+}
+
+// Builds the net of a de Bruijn form with its root on `host`. Variables used
+// more than once get a chain of fans with fresh labels, unused ones an eraser
+uint32_t inetCompile(expr db, uint32_t host) {
+    size_t funs = dbFunCount(db);
+    size_t *counts = termAlloc((funs + 1) * sizeof(size_t));
+    size_t *binders = termAlloc((funs + 1) * sizeof(size_t));
+    memset(counts, 0, (funs + 1) * sizeof(size_t));
+
+    depthStack stack = mkds();
+    dspush(&stack, 0);
+    size_t fun = 0;
+    for(byte *data = db.data; stack.len > 0; data += dbNodeLen(data)) {
+        size_t depth = stack.items[--stack.len];
+        exprType type = *(exprType *)data;
+
+        if(type == EXPR_FUN) binders[depth] = fun++;
+        if(isBind(type) && dbIndex(data) < depth) counts[binders[depth - 1 - dbIndex(data)]]++;
+        for(size_t i = 0; i < dbChildren(type); i++) dspush(&stack, depth + (type == EXPR_FUN));
+    }
+
+    uint32_t **pools = termAlloc((funs + 1) * sizeof(uint32_t *));
+    size_t *used = termAlloc((funs + 1) * sizeof(size_t));
+    memset(used, 0, (funs + 1) * sizeof(size_t));
+
+    // Pending subterms: the port their root goes on, and their depth
+    size_t cap = 64;
+    size_t len = 0;
+    uint32_t *ports = termAlloc(cap * sizeof(uint32_t));
+    size_t *depths = termAlloc(cap * sizeof(size_t));
+    ports[len] = host;
+    depths[len++] = 0;
+
+    fun = 0;
+    for(byte *data = db.data; len > 0; data += dbNodeLen(data)) {
+        uint32_t expect = ports[--len];
+        size_t depth = depths[len];
+        exprType type = *(exprType *)data;
+
+        if(len + 2 > cap) {
+            uint32_t *nports = termAlloc(cap * 2 * sizeof(uint32_t));
+            size_t *ndepths = termAlloc(cap * 2 * sizeof(size_t));
+            memcpy(nports, ports, len * sizeof(uint32_t));
+            memcpy(ndepths, depths, len * sizeof(size_t));
+            ports = nports;
+            depths = ndepths;
+            cap *= 2;
+        }
+
+        if(false) {}
+        else if(type == EXPR_FUN) {
+            uint32_t lam = inetNew(INET_LAM);
+            inetLink(expect, inetPort(lam, 0));
+
+            size_t f = fun++;
+            binders[depth] = f;
+            size_t k = counts[f];
+            pools[f] = termAlloc((k + 1) * sizeof(uint32_t));
+
+            uint32_t cur = inetPort(lam, 2);
+            if(k == 0) {
+                uint32_t era = inetNew(INET_ERA);
+                inetLink(cur, inetPort(era, 0));
+            }
+            for(size_t i = 0; i + 1 < k; i++) {
+                uint32_t dup = inetNew(INET_DUP);
+                inetNodes[dup].label = inetLabel++;
+                inetLink(cur, inetPort(dup, 0));
+                pools[f][i] = inetPort(dup, 1);
+                cur = inetPort(dup, 2);
+            }
+            if(k > 0) pools[f][k - 1] = cur;
+
+            ports[len] = inetPort(lam, 1);
+            depths[len++] = depth + 1;
+        }
+        else if(type == EXPR_APP) {
+            uint32_t app = inetNew(INET_APP);
+            inetLink(expect, inetPort(app, 2));
+            ports[len] = inetPort(app, 1);
+            depths[len++] = depth;
+            ports[len] = inetPort(app, 0);
+            depths[len++] = depth;
+        }
+        else if(isBind(type) && dbIndex(data) < depth) {
+            size_t f = binders[depth - 1 - dbIndex(data)];
+            inetLink(expect, pools[f][used[f]++]);
+        }
+        else {
+            byte kind = INET_VAR;
+            if(type == EXPR_REF)             kind = INET_REF;
+            else if(type == EXPR_IMPURE_VAL) kind = INET_VAL;
+            else if(type == EXPR_IMPURE_FUN) kind = INET_OP;
+
+            uint32_t n = inetNew(kind);
+            if(kind == INET_VAR)      inetNodes[n].label = inetFree.items[dbIndex(data) - depth];
+            else if(kind == INET_REF) inetNodes[n].label = readField(refId, data + sizeof(exprType));
+            else                      inetNodes[n].data = data;
+            inetLink(expect, inetPort(n, 0));
+        }
+    }
+
+    dsfree(stack);
+    return inetPeer(host);
+}
+
+static inline bool inetIsStuck(uint32_t port) {
+    inetNode *n = &inetNodes[inetNodeOf(port)];
+    return n->stuck && ((n->kind == INET_APP && inetSlot(port) == 2) || (n->kind == INET_OPA && inetSlot(port) == 1));
+}
+
+// Reduces the term on the other side of `host` to weak head normal form.
+// The stack holds the ports waiting for the term on their other side
+bool inetWhnf(uint32_t host) {
+    size_t bottom = inetStackLen;
+    inetPush(host);
+
+    while(inetStackLen > bottom) {
+        // Waiting on more ports than there are agents means going round a
+        // cycle, which a λ-term doesn't have either
+        if(inetCount > INET_MAX_NODES || inetInteractions > inetBudget || inetStackLen - bottom > inetCount) {
+            inetFailed = true;
+            break;
+        }
+
+        uint32_t t = inetPeer(inetStack[inetStackLen - 1]);
+        uint32_t n = inetNodeOf(t);
+        byte kind = inetNodes[n].kind;
+
+        if(inetSlot(t) == 0) {
+            // A value, or an agent the one waiting for it interacts with.
+            // Only a superposition or something erased can't be read back
+            if(inetStackLen == bottom + 1 && kind != INET_LAM && kind != INET_VAR && kind != INET_VAL && kind != INET_OP && kind != INET_REF) {
+                inetFailed = true;
+                break;
+            }
+            inetStackLen--;
+        }
+        else if(kind == INET_APP || kind == INET_OPA) {
+            uint32_t f = inetPeer(inetPort(n, 0));
+
+            if(inetNodes[n].stuck) {
+                inetStackLen--;
+            }
+            else if(inetSlot(f) == 0) {
+                if(!inetInteract(n, inetNodeOf(f))) {
+                    inetNodes[n].stuck = true;
+                    inetStackLen--;
+                }
+            }
+            else if(inetIsStuck(f)) {
+                inetNodes[n].stuck = true;
+                inetStackLen--;
+            }
+            else {
+                inetPush(inetPort(n, 0));
+            }
+        }
+        else if(kind == INET_DUP) {
+            uint32_t p = inetPeer(inetPort(n, 0));
+
+            if(inetSlot(p) == 0) {
+                inetInteract(n, inetNodeOf(p));
+            }
+            else if(inetIsStuck(p)) {
+                inetCommute(n, 0, inetNodeOf(p), inetSlot(p));
+                inetInteractions++;
+            }
+            else if(inetNodes[inetNodeOf(p)].kind == INET_LAM) {
+                inetFailed = true;
+                break;
+            }
+            else {
+                inetPush(inetPort(n, 0));
+            }
+        }
+        else {
+            inetFailed = true;
+            break;
+        }
+    }
+
+    inetStackLen = bottom;
+    return !inetFailed;
+}
+
+// A λ read back so far and where its body is on the pending stack: the
+// body is done once something below it is popped
+typedef struct {
+    bindt bind;
+    size_t mark;
+} inetScope;
+
+// Whether a variable read back is bound by a λ around it or free in the
+// whole term. Without brackets a fan can move a variable out of its λ, and
+// such a net has no λ-term to read back
+bool inetInScope(bindt bind, inetScope *scopes, size_t scopesLen) {
+    for(size_t i = scopesLen; i > 0; i--) {
+        if(scopes[i - 1].bind == bind) return true;
+    }
+    for(size_t i = 0; i < inetFree.len; i++) {
+        if(inetFree.items[i] == bind) return true;
+    }
+    return false;
+}
+
+// Reads the normal form back into named form, in inetArena
+expr inetReadBack(uint32_t root) {
+    size_t pendingCap = 64;
+    size_t pendingLen = 0;
+    uint32_t *pending = termAlloc(pendingCap * sizeof(uint32_t));
+    pending[pendingLen++] = root;
+
+    size_t scopesCap = 64;
+    size_t scopesLen = 0;
+    inetScope *scopes = termAlloc(scopesCap * sizeof(inetScope));
+
+    size_t cap = 256;
+    expr out = { .data = termAlloc(cap), .len = 0, .aux = true };
+
+    while(pendingLen > 0 && !inetFailed) {
+        uint32_t host = pending[--pendingLen];
+        while(scopesLen > 0 && scopes[scopesLen - 1].mark > pendingLen) scopesLen--;
+        if(!inetWhnf(host)) break;
+
+        uint32_t t = inetPeer(host);
+        uint32_t n = inetNodeOf(t);
+        byte kind = inetNodes[n].kind;
+
+        if(kind == INET_REF && !sharedTable[inetNodes[n].label].normal) {
+            inetExpand(n);
+            pending[pendingLen++] = host;
+            continue;
+        }
+
+        size_t len = 0;
+        if(false) {}
+        else if(kind == INET_REF) len = REF_LEN;
+        else if(kind == INET_LAM) len = FUN_LEN;
+        else if(kind == INET_VAR) len = BIND_LEN;
+        else if(kind == INET_APP) len = sizeof(exprType);
+        else if(kind == INET_OPA) len = sizeof(exprType) + IMPURE_FUN_LEN;
+        else if(kind == INET_VAL) len = impureValLen(inetNodes[n].data);
+        else if(kind == INET_OP)  len = IMPURE_FUN_LEN;
+
+        if(out.len + len > cap) {
+            while(out.len + len > cap) cap *= 2;
+            byte *ndata = termAlloc(cap);
+            memcpy(ndata, out.data, out.len);
+            out.data = ndata;
+        }
+        byte *data = out.data + out.len;
+        out.len += len;
+
+        if(pendingLen + 2 > pendingCap) {
+            uint32_t *npending = termAlloc(pendingCap * 2 * sizeof(uint32_t));
+            memcpy(npending, pending, pendingLen * sizeof(uint32_t));
+            pending = npending;
+            pendingCap *= 2;
+        }
+
+        if(false) {}
+        else if(kind == INET_REF) {
+            *(exprType *)data = EXPR_REF;
+            writeField(refId, data + sizeof(exprType), inetNodes[n].label);
+        }
+        else if(kind == INET_LAM) {
+            var(bind);
+            uint32_t fresh = inetNew(INET_VAR);
+            inetNodes[fresh].label = bind;
+            uint32_t probe = inetNew(INET_APP);
+            inetLink(inetPort(probe, 0), t);
+            inetLink(inetPort(probe, 1), inetPort(fresh, 0));
+            inetLink(inetPort(probe, 2), host);
+            inetBeta(probe, n);
+
+            *(exprType *)data = EXPR_FUN;
+            writeField(bindt, data + sizeof(exprType), bind);
+
+            if(scopesLen == scopesCap) {
+                inetScope *nscopes = termAlloc(scopesCap * 2 * sizeof(inetScope));
+                memcpy(nscopes, scopes, scopesLen * sizeof(inetScope));
+                scopes = nscopes;
+                scopesCap *= 2;
+            }
+            scopes[scopesLen++] = (inetScope){ .bind = bind, .mark = pendingLen };
+            pending[pendingLen++] = host;
+        }
+        else if(kind == INET_VAR) {
+            if(!inetInScope(inetNodes[n].label, scopes, scopesLen)) {
+                inetFailed = true;
+                break;
+            }
+            *(exprType *)data = EXPR_BIND;
+            writeField(bindt, data + sizeof(exprType), inetNodes[n].label);
+        }
+        else if(kind == INET_APP) {
+            *(exprType *)data = EXPR_APP;
+            pending[pendingLen++] = inetPort(n, 1);
+            pending[pendingLen++] = inetPort(n, 0);
+        }
+        else if(kind == INET_OPA) {
+            *(exprType *)data = EXPR_APP;
+            memcpy(data + sizeof(exprType), inetNodes[n].data, IMPURE_FUN_LEN);
+            pending[pendingLen++] = inetPort(n, 0);
+        }
+        else {
+            memcpy(data, inetNodes[n].data, len);
+        }
+    }
+
+    return out;
+}
+
+void evaluateInet(expr *e) {
+    int64_t steps = runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies;
+    arena *prev = arenaEnter(&inetArena);
+
+    inetCount = 0;
+    inetFreeList = 0;
+    inetLabel = 0;
+    inetFailed = false;
+    inetBudget = inetInteractions + INET_MAX_INTERACTIONS;
+    inetStack = NULL;
+    inetStackLen = 0;
+    inetStackCap = 0;
+    inetFree = mkbl();
+
+    depthStack stack = mkds();
+    bindt *binds = termAlloc((e->len / FUN_LEN + 1) * sizeof(bindt));
+    byte *code = termAlloc(e->len);
+    size_t len = deBruijnInto(*e, code, binds, &stack, NULL, &inetFree);
+
+    // Node 0 is the root, so 0 also works as the end of the free list
+    uint32_t root = inetNew(INET_ROOT);
+    inetCompile((expr){ .data = code, .len = len }, inetPort(root, 0));
+    expr nf = inetReadBack(inetPort(root, 0));
+
+    arenaLeave(prev);
+
+    if(inetFailed) {
+        inetFallbacks++;
+        arenaReset(&inetArena);
+        evaluateNbe(e);
+        return;
+    }
+
+    if(runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies > steps) {
+        runStats.bytesMoved += nf.len;
+        if(nf.len > runStats.peakLen) runStats.peakLen = nf.len;
+
+        termFree(e->data);
+        e->data = termAlloc(nf.len);
+        e->len = nf.len;
+        memcpy(e->data, nf.data, nf.len);
+    }
+
+    arenaReset(&inetArena);
+}
+
+// ==================
+// COMBINATORS
+// ==================
+
+// EVAL_SKI compiles the term into S, K, I, B and C by bracket abstraction
+// and runs it on a combinator graph reducer. There are no variables left to
+// substitute: each combinator rewrites the application node at the root of
+// its redex in place, so an argument duplicated by S stays shared. Shared
+// terms are the supercombinators, compiled once into skiCodeArena and
+// copied into the graph the first time an evaluation needs them, so every
+// App(Pred, …) in it reuses the same reduced graph of Pred
+//
+// Abstraction uses no η rule ([x](M x) is B M I, not M), which keeps the
+// normal form read back by applying partial applications to fresh variables
+// exactly the one of the term. Each combinator step counts as a beta step
+
+#define SKI_APP 0
+#define SKI_COMB 1
+#define SKI_VAR 2
+#define SKI_VAL 3
+#define SKI_OP 4
+#define SKI_REF 5
+#define SKI_IND 6
+#define SKI_FUN 7
+
+#define SKI_S 0
+#define SKI_K 1
+#define SKI_I 2
+#define SKI_B 3
+#define SKI_C 4
+
+// `level` is the deepest binder the node mentions (-1 for none) while it is
+// compiled, FUN only exists until its body is abstracted. `id` is the binder
+// of a VAR and the shared term of a REF, IND points at lhs
+typedef struct skiNode {
+    byte kind;
+    byte comb;
+    int32_t level;
+    bindt id;
+    struct skiNode *lhs;
+    struct skiNode *rhs;
+    byte *data;
+} skiNode;
+
+size_t skiArity[] = { 3, 2, 1, 3, 3 };
+
+// Combinators are never rewritten, so there is one of each
+skiNode skiCombs[] = {
+    { .kind = SKI_COMB, .comb = SKI_S, .level = -1 },
+    { .kind = SKI_COMB, .comb = SKI_K, .level = -1 },
+    { .kind = SKI_COMB, .comb = SKI_I, .level = -1 },
+    { .kind = SKI_COMB, .comb = SKI_B, .level = -1 },
+    { .kind = SKI_COMB, .comb = SKI_C, .level = -1 },
+};
+
+// Compiled shared terms stay in skiCodeArena, the graph goes to skiArena
+// which is reset after every evaluation
+_Thread_local arena skiArena = {0};
+_Thread_local arena skiCodeArena = {0};
+_Thread_local skiNode **skiShared = NULL;
+_Thread_local refId skiSharedCap = 0;
+_Thread_local skiNode **skiRefs = NULL;
+_Thread_local bindList skiFree = {0};
+
+// An impure function forces its argument as a spine of its own above the
+// one it is in: `bottom` is where the outer spine started on skiStack
+typedef struct skiForce {
+    size_t bottom;
+    skiNode *op;
+} skiForce;
+
+_Thread_local skiNode **skiStack = NULL;
+_Thread_local size_t skiStackLen = 0;
+_Thread_local size_t skiStackCap = 0;
+_Thread_local skiForce *skiForces = NULL;
+_Thread_local size_t skiForcesLen = 0;
+_Thread_local size_t skiForcesCap = 0;
+
+skiNode *skiNew(arena *a, byte kind) {
+    skiNode *n = arenaAlloc(a, sizeof(skiNode));
+    memset(n, 0, sizeof(skiNode));
+    n->kind = kind;
+    n->level = -1;
+    return n;
+}
+
+skiNode *skiApp(arena *a, skiNode *lhs, skiNode *rhs) {
+    skiNode *n = skiNew(a, SKI_APP);
+    n->lhs = lhs;
+    n->rhs = rhs;
+    n->level = lhs->level > rhs->level ? lhs->level : rhs->level;
+    return n;
+}
+
+// Abstraction and copying walk the tree with a stack of holes: a node is
+// made before its children, which fill in the hole they were pushed with,
+// so a term as deep as a long numeral doesn't grow the C stack
+typedef struct skiHole {
+    skiNode *node;
+    skiNode **dest;
+} skiHole;
+
+_Thread_local skiHole *skiHoles = NULL;
+_Thread_local size_t skiHolesCap = 0;
+_Thread_local skiNode **skiMade = NULL;
+_Thread_local size_t skiMadeCap = 0;
+
+void skiPushHole(size_t *len, skiNode *node, skiNode **dest) {
+    if(*len == skiHolesCap) {
+        skiHolesCap = skiHolesCap * 2 + 64;
+        skiHoles = Realloc(skiHoles, skiHolesCap * sizeof(skiHole));
+    }
+    skiHoles[(*len)++] = (skiHole){ .node = node, .dest = dest };
+}
+
+// [x]t for the binder at `level`, which is the deepest one `t` can mention.
+// The applications it makes get their levels once every hole is filled,
+// last made first so children come before their parents
+skiNode *skiAbstract(skiNode *t, int32_t level, arena *a) {
+    skiNode *root = NULL;
+    size_t len = 0;
+    size_t made = 0;
+    skiPushHole(&len, t, &root);
+
+    while(len > 0) {
+        skiHole h = skiHoles[--len];
+        skiNode *n = h.node;
+
+        if(n->level < level) {
+            *h.dest = skiApp(a, &skiCombs[SKI_K], n);
+            continue;
+        }
+        if(n->kind == SKI_VAR) {
+            *h.dest = &skiCombs[SKI_I];
+            continue;
+        }
+
+        bool inLhs = n->lhs->level == level;
+        bool inRhs = n->rhs->level == level;
+        byte comb = inLhs && inRhs ? SKI_S : inLhs ? SKI_C : SKI_B;
+
+        skiNode *inner = skiNew(a, SKI_APP);
+        skiNode *outer = skiNew(a, SKI_APP);
+        inner->lhs = &skiCombs[comb];
+        inner->rhs = n->lhs;
+        outer->lhs = inner;
+        outer->rhs = n->rhs;
+        *h.dest = outer;
+
+        if(inLhs) skiPushHole(&len, n->lhs, &inner->rhs);
+        if(inRhs) skiPushHole(&len, n->rhs, &outer->rhs);
+
+        if(made + 2 > skiMadeCap) {
+            skiMadeCap = skiMadeCap * 2 + 64;
+            skiMade = Realloc(skiMade, skiMadeCap * sizeof(skiNode *));
+        }
+        skiMade[made++] = outer;
+        skiMade[made++] = inner;
+    }
+
+    while(made > 0) {
+        skiNode *n = skiMade[--made];
+        n->level = n->lhs->level > n->rhs->level ? n->lhs->level : n->rhs->level;
+    }
+    return root;
+}
+
+// Compiles a de Bruijn form into `a`, in one pre-order pass like
+// nbeCompile. A function is abstracted as soon as its body is complete,
+// which leaves the innermost binder as the deepest level in it
+skiNode *skiCompile(expr db, arena *a) {
+    size_t cap = 64;
+    size_t len = 0;
+    skiNode **open = termAlloc(cap * sizeof(skiNode *));
+    skiNode *root = NULL;
+    int32_t depth = 0;
+
+    for(byte *data = db.data; data < db.data + db.len; data += dbNodeLen(data)) {
+        exprType type = *(exprType *)data;
+        skiNode *c;
+
+        if(false) {}
+        else if(type == EXPR_FUN) {
+            c = skiNew(a, SKI_FUN);
+            c->level = depth++;
+        }
+        else if(type == EXPR_APP) {
+            c = skiNew(a, SKI_APP);
+        }
+        else if(isBind(type) && dbIndex(data) < (size_t)depth) {
+            c = skiNew(a, SKI_VAR);
+            c->level = depth - 1 - dbIndex(data);
+        }
+        else if(isBind(type)) {
+            c = skiNew(a, SKI_VAR);
+            c->id = skiFree.items[dbIndex(data) - depth];
+        }
+        else if(type == EXPR_REF) {
+            c = skiNew(a, SKI_REF);
+            c->id = readField(refId, data + sizeof(exprType));
+        }
+        else {
+            size_t nlen = dbNodeLen(data);
+            c = skiNew(a, type == EXPR_IMPURE_VAL ? SKI_VAL : SKI_OP);
+            c->data = arenaAlloc(a, nlen);
+            memcpy(c->data, data, nlen);
+        }
+
+        if(len == 0)                                       root = c;
+        else if(open[len - 1]->kind == SKI_FUN)            open[len - 1]->lhs = c;
+        else if(open[len - 1]->lhs == NULL)                open[len - 1]->lhs = c;
+        else                                               open[len - 1]->rhs = c;
+
+        if(dbChildren(type) > 0) {
+            if(len == cap) {
+                skiNode **nopen = termAlloc(cap * 2 * sizeof(skiNode *));
+                memcpy(nopen, open, len * sizeof(skiNode *));
+                open = nopen;
+                cap *= 2;
+            }
+            open[len++] = c;
+            continue;
+        }
+
+        while(len > 0) {
+            skiNode *top = open[len - 1];
+            if(top->kind == SKI_APP && top->rhs == NULL) break;
+
+            if(top->kind == SKI_APP) {
+                top->level = top->lhs->level > top->rhs->level ? top->lhs->level : top->rhs->level;
+            }
+            else {
+                *top = *skiAbstract(top->lhs, top->level, a);
+                depth--;
+            }
+            len--;
+        }
+    }
+
+    return root;
+}
+
+skiNode *skiCopy(skiNode *n) {
+    skiNode *root = NULL;
+    size_t len = 0;
+    skiPushHole(&len, n, &root);
+
+    while(len > 0) {
+        skiHole h = skiHoles[--len];
+        if(h.node->kind == SKI_COMB) {
+            *h.dest = h.node;
+            continue;
+        }
+
+        skiNode *c = skiNew(&skiArena, h.node->kind);
+        *c = *h.node;
+        *h.dest = c;
+        if(c->kind == SKI_APP) {
+            skiPushHole(&len, c->rhs, &c->rhs);
+            skiPushHole(&len, c->lhs, &c->lhs);
+        }
+    }
+    return root;
+}
+
+skiNode *skiRef(refId id) {
+    if(skiRefs[id] != NULL) return skiRefs[id];
+
+    if(id >= skiSharedCap) {
+        refId ncap = sharedCount;
+        skiShared = Realloc(skiShared, ncap * sizeof(skiNode *));
+        memset(skiShared + skiSharedCap, 0, (ncap - skiSharedCap) * sizeof(skiNode *));
+        skiSharedCap = ncap;
+    }
+    if(skiShared[id] == NULL) {
+        arena *prev = arenaEnter(&skiCodeArena);
+        skiShared[id] = skiCompile(sharedTable[id].canon, &skiCodeArena);
+        arenaLeave(prev);
+    }
+
+    skiRefs[id] = skiCopy(skiShared[id]);
+    runStats.sharedCopies++;
+    return skiRefs[id];
+}
+
+void skiPush(skiNode *n) {
+    if(skiStackLen == skiStackCap) {
+        size_t ncap = skiStackCap * 2 + 64;
+        skiNode **nitems = termAlloc(ncap * sizeof(skiNode *));
+        if(skiStackLen > 0) memcpy(nitems, skiStack, skiStackLen * sizeof(skiNode *));
+        skiStack = nitems;
+        skiStackCap = ncap;
+    }
+    skiStack[skiStackLen++] = n;
+}
+
+void skiPushForce(size_t bottom, skiNode *op) {
+    if(skiForcesLen == skiForcesCap) {
+        size_t ncap = skiForcesCap * 2 + 64;
+        skiForce *nitems = termAlloc(ncap * sizeof(skiForce));
+        if(skiForcesLen > 0) memcpy(nitems, skiForces, skiForcesLen * sizeof(skiForce));
+        skiForces = nitems;
+        skiForcesCap = ncap;
+    }
+    skiForces[skiForcesLen++] = (skiForce){ .bottom = bottom, .op = op };
+}
+
+// Reduces `n` to weak head normal form by unwinding its spine onto skiStack:
+// a combinator with all its arguments there rewrites the node at the root of
+// its redex. Returns the node the spine now starts at
+skiNode *skiWhnf(skiNode *n) {
+    size_t bottom = skiStackLen;
+    size_t forces = skiForcesLen;
+    skiNode *cur = n;
+    bool forced = false;
+
+    while(true) {
+        while(cur->kind == SKI_IND) cur = cur->lhs;
+
+        size_t args = skiStackLen - bottom;
+        skiNode **top = skiStack + skiStackLen;
+        bool stuck = false;
+
+        if(false) {}
+        else if(cur->kind == SKI_APP) {
+            skiPush(cur);
+            cur = cur->lhs;
+        }
+        else if(cur->kind == SKI_REF) {
+            cur = skiRef(cur->id);
+        }
+        else if(cur->kind == SKI_COMB && args >= skiArity[cur->comb]) {
+            size_t k = skiArity[cur->comb];
+            skiNode *root = top[-k];
+            skiNode *x = top[-1]->rhs;
+            skiNode *y = k > 1 ? top[-2]->rhs : NULL;
+            skiNode *z = k > 2 ? top[-3]->rhs : NULL;
+
+            if(false) {}
+            else if(cur->comb == SKI_I) {
+                root->kind = SKI_IND;
+                root->lhs = x;
+            }
+            else if(cur->comb == SKI_K) {
+                root->kind = SKI_IND;
+                root->lhs = x;
+            }
+            else if(cur->comb == SKI_S) {
+                root->lhs = skiApp(&skiArena, x, z);
+                root->rhs = skiApp(&skiArena, y, z);
+            }
+            else if(cur->comb == SKI_B) {
+                root->lhs = x;
+                root->rhs = skiApp(&skiArena, y, z);
+            }
+            else if(cur->comb == SKI_C) {
+                root->lhs = skiApp(&skiArena, x, z);
+                root->rhs = y;
+            }
+
+            runStats.betaSteps++;
+            skiStackLen -= k;
+            cur = root;
+        }
+        else if(cur->kind == SKI_OP && args >= 1) {
+            skiNode *app = top[-1];
+            skiNode *arg = app->rhs;
+            while(arg->kind == SKI_IND) arg = arg->lhs;
+            app->rhs = arg;
+
+            if(false) {}
+            else if(arg->kind != SKI_VAL && !forced) {
+                skiPushForce(bottom, cur);
+                bottom = skiStackLen;
+                cur = arg;
+            }
+            else if(arg->kind != SKI_VAL) {
+                forced = false;
+                stuck = true;
+            }
+            else {
+                impureFunpt imfun = impureAt(cur->data + sizeof(exprType));
+                expr result = imfun(arg->data, impureValLen(arg->data));
+                runStats.impureCalls++;
+
+                if(*(exprType *)result.data == EXPR_IMPURE_VAL) {
+                    app->kind = SKI_VAL;
+                    app->data = result.data;
+                }
+                else {
+                    app->kind = SKI_IND;
+                    app->lhs = skiCompile(toDeBruijn(result, NULL), &skiArena);
+                }
+                forced = false;
+                skiStackLen--;
+                cur = app;
+            }
+        }
+        else {
+            stuck = true;
+        }
+
+        if(!stuck) continue;
+
+        if(skiStackLen > bottom) cur = skiStack[bottom];
+        skiStackLen = bottom;
+        if(skiForcesLen == forces) return cur;
+
+        // The argument is as far as it goes, back to the function forcing it
+        skiForce f = skiForces[--skiForcesLen];
+        bottom = f.bottom;
+        skiStack[skiStackLen - 1]->rhs = cur;
+        cur = f.op;
+        forced = true;
+    }
+}
+
+// Reads the normal form back into named form in skiArena, pre-order like
+// nbeQuote. A partial application of a combinator is a function and gets
+// applied to a fresh variable, anything else is a spine of arguments
+expr skiReadBack(skiNode *root) {
+    size_t pendingCap = 64;
+    size_t pendingLen = 0;
+    skiNode **pending = termAlloc(pendingCap * sizeof(skiNode *));
+    pending[pendingLen++] = root;
+
+    size_t cap = 256;
+    expr out = { .data = termAlloc(cap), .len = 0, .aux = true };
+
+    while(pendingLen > 0) {
+        skiNode *n = pending[--pendingLen];
+        while(n->kind == SKI_IND) n = n->lhs;
+
+        bool asRef = n->kind == SKI_REF && sharedTable[n->id].normal;
+        if(!asRef) n = skiWhnf(n);
+
+        size_t args = 0;
+        skiNode *head = n;
+        while(!asRef && (head->kind == SKI_APP || head->kind == SKI_IND)) {
+            if(head->kind == SKI_APP) args++;
+            head = head->lhs;
+        }
+        bool isFun = !asRef && head->kind == SKI_COMB && args < skiArity[head->comb];
+
+        size_t len = args;
+        if(false) {}
+        else if(asRef)                  len = REF_LEN;
+        else if(isFun)                  len = FUN_LEN;
+        else if(head->kind == SKI_VAR)  len += BIND_LEN;
+        else if(head->kind == SKI_VAL)  len += impureValLen(head->data);
+        else if(head->kind == SKI_OP)   len += IMPURE_FUN_LEN;
+
+        if(out.len + len > cap) {
+            while(out.len + len > cap) cap *= 2;
+            byte *ndata = termAlloc(cap);
+            memcpy(ndata, out.data, out.len);
+            out.data = ndata;
+        }
+        byte *data = out.data + out.len;
+        out.len += len;
+
+        if(pendingLen + args + 1 > pendingCap) {
+            while(pendingLen + args + 1 > pendingCap) pendingCap *= 2;
+            skiNode **npending = termAlloc(pendingCap * sizeof(skiNode *));
+            memcpy(npending, pending, pendingLen * sizeof(skiNode *));
+            pending = npending;
+        }
+
+        if(false) {}
+        else if(asRef) {
+            *(exprType *)data = EXPR_REF;
+            writeField(refId, data + sizeof(exprType), n->id);
+        }
+        else if(isFun) {
+            var(bind);
+            skiNode *fresh = skiNew(&skiArena, SKI_VAR);
+            fresh->id = bind;
+
+            *(exprType *)data = EXPR_FUN;
+            writeField(bindt, data + sizeof(exprType), bind);
+            pending[pendingLen++] = skiApp(&skiArena, n, fresh);
+        }
+        else {
+            // The arguments come off the spine last first, which is the
+            // order they have to be pending in
+            for(size_t i = 0; i < args; i++) data[i] = EXPR_APP;
+            for(skiNode *s = n; s != head; s = s->lhs) {
+                if(s->kind == SKI_APP) pending[pendingLen++] = s->rhs;
+            }
+
+            data += args;
+            if(head->kind == SKI_VAR) {
+                *(exprType *)data = EXPR_BIND;
+                writeField(bindt, data + sizeof(exprType), head->id);
+            }
+            else {
+                memcpy(data, head->data, len - args);
+            }
+        }
+    }
+
+    return out;
+}
+
+void evaluateSki(expr *e) {
+    int64_t steps = runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies;
+    arena *prev = arenaEnter(&skiArena);
+
+    skiFree = mkbl();
+    skiRefs = termAlloc((sharedCount + 1) * sizeof(skiNode *));
+    memset(skiRefs, 0, (sharedCount + 1) * sizeof(skiNode *));
+    skiStack = NULL;
+    skiStackLen = 0;
+    skiStackCap = 0;
+    skiForces = NULL;
+    skiForcesLen = 0;
+    skiForcesCap = 0;
+
+    depthStack stack = mkds();
+    bindt *binds = termAlloc((e->len / FUN_LEN + 1) * sizeof(bindt));
+    byte *code = termAlloc(e->len);
+    size_t len = deBruijnInto(*e, code, binds, &stack, NULL, &skiFree);
+
+    skiNode *root = skiCompile((expr){ .data = code, .len = len }, &skiArena);
+    expr nf = skiReadBack(root);
+
+    arenaLeave(prev);
+
+    if(runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies > steps) {
+        runStats.bytesMoved += nf.len;
+        if(nf.len > runStats.peakLen) runStats.peakLen = nf.len;
+
+        termFree(e->data);
+        e->data = termAlloc(nf.len);
+        e->len = nf.len;
+        memcpy(e->data, nf.data, nf.len);
+    }
+
+    arenaReset(&skiArena);
+}
+
+// ==================
+// STRATEGIES
+// ==================
+
+// What evaluate() runs, picked through evalMode
+#define EVAL_SINGLE 0
+#define EVAL_DEBRUIJN 1
+#define EVAL_LAZY 2
+#define EVAL_GRAPH 3
+#define EVAL_KRIVINE 4
+#define EVAL_NBE 5
+// Experimental, see INTERACTION NETS
+#define EVAL_INET 6
+#define EVAL_SKI 7
+#define EVAL_NATIVE 8
+#define EVAL_PARALLEL 9
+_Thread_local int evalMode = EVAL_SINGLE;
+
+char *evalModeName(int mode) {
+    if(false) {}
+    else if(mode == EVAL_DEBRUIJN) return "debruijn";
+    else if(mode == EVAL_LAZY)     return "lazy";
+    else if(mode == EVAL_GRAPH)    return "graph";
+    else if(mode == EVAL_KRIVINE)  return "krivine";
+    else if(mode == EVAL_NBE)      return "nbe";
+    else if(mode == EVAL_INET)     return "inet";
+    else if(mode == EVAL_SKI)      return "ski";
+    else if(mode == EVAL_NATIVE)   return "native";
+    else if(mode == EVAL_PARALLEL) return "parallel";
+    else                           return "single";
+}
+
+// See PARALLEL REDUCTION
+void evaluateParallel(expr *e);
+
+void evaluateStrategy(expr *e) {
+    if(false) {}
+    else if(evalMode == EVAL_DEBRUIJN) evaluateDeBruijn(e);
+    else if(evalMode == EVAL_LAZY)     evaluateLazy(e);
+    else if(evalMode == EVAL_GRAPH)    evaluateGraph(e);
+    else if(evalMode == EVAL_KRIVINE)  evaluateKrivine(e);
+    else if(evalMode == EVAL_NBE)      evaluateNbe(e);
+    else if(evalMode == EVAL_INET)     evaluateInet(e);
+    else if(evalMode == EVAL_SKI)      evaluateSki(e);
+    else if(evalMode == EVAL_NATIVE)   evaluateNative(e);
+    else if(evalMode == EVAL_PARALLEL) evaluateParallel(e);
+    else                               evaluateSingle(e);
+}
+
+void evaluate(expr *e) {
+    runStats = (evalStats){ .peakLen = e->len };
+
+    if(useNormalCache && *(exprType *)e->data == EXPR_APP) {
+        expr nf;
+        normalCached(*e, &nf, evaluateStrategy);
+
+        termFree(e->data);
+        e->data = termAlloc(nf.len);
+        e->len = nf.len;
+        memcpy(e->data, nf.data, nf.len);
+    }
+    else {
+        evaluateStrategy(e);
+    }
+
+    lastStats = runStats;
+    addStats(&totalStats, runStats);
+}
+
+// Evaluation a budget at a time. evalStart copies the term into a handle,
+// evalRun reduces it for at most `steps` steps or `ns` nanoseconds (negative
+// or zero for no limit) and says whether it reached its normal form or ran
+// out, in which case the next evalRun carries on from where it stopped.
+// Only the rewriting strategies can stop between steps, so the handle uses
+// evalMode if it is one of them and EVAL_DEBRUIJN otherwise. Runs are in
+// lastStats as usual, the handle adds them all up
+#define EVAL_NORMAL 0
+#define EVAL_EXHAUSTED 1
+
+typedef struct {
+    expr term;
+    int status;
+    evalStats stats;
+} evalHandle;
+
+evalHandle evalStart(expr e) {
+    evalHandle h = { .term = e, .status = EVAL_EXHAUSTED };
+    h.term.data = Malloc(e.len);
+    memcpy(h.term.data, e.data, e.len);
+    return h;
+}
+
+int evalRun(evalHandle *h, int64_t steps, int64_t ns) {
+    if(h->status == EVAL_NORMAL) return EVAL_NORMAL;
+
+    arena *prev = arenaEnter(NULL);
+    runStats = (evalStats){ .peakLen = h->term.len };
+    fuelSteps = steps > 0 ? steps : -1;
+    fuelDeadline = ns > 0 ? nowNs() + ns : 0;
+    fuelChecks = 0;
+    fuelExhausted = false;
+
+    if(false) {}
+    else if(evalMode == EVAL_SINGLE) evaluateSingle(&h->term);
+    else                             evaluateDeBruijn(&h->term);
+
+    h->status = fuelExhausted ? EVAL_EXHAUSTED : EVAL_NORMAL;
+    fuelSteps = -1;
+    fuelDeadline = 0;
+    fuelExhausted = false;
+    arenaLeave(prev);
+
+    lastStats = runStats;
+    addStats(&totalStats, runStats);
+    addStats(&h->stats, runStats);
+    return h->status;
+}
+
+void evalFree(evalHandle *h) {
+    Free(h->term.data);
+    h->term = (expr){0};
+}
+
+// ==================
+// CONTEXTS
+// ==================
+
+// Everything an evaluation changes is thread local: its binder range, the
+// current arena, runStats and the stats after it, evalMode, and the scratch
+// space and caches of every strategy. So each thread is an evaluation
+// context of its own, and the strategies' counters printed with MEM_STATS
+// are the main thread's. Definitions (sharedTable, impureTable) stay global,
+// they must not change while a batch runs
+//
+// Work goes to a pool of worker threads as jobs on one shared stack, newest
+// first. A thread waiting for a group of jobs runs queued jobs meanwhile, so
+// jobs can fork jobs of their own and wait on them. Every job runs with its
+// own stats, in the evalMode it was queued with and without an arena, so its
+// terms must be on the heap. The workers are started on first use and kept,
+// with their caches, for later jobs
+//
+// evaluateBatch evaluates independent terms in place, one job each, and adds
+// the stats of all of them to the caller's totalStats
+
+typedef struct {
+    size_t pending;
+    evalStats stats;
+} poolGroup;
+
+typedef struct poolJob {
+    void (*run)(struct poolJob *job);
+    expr *term;
+    int mode;
+    poolGroup *group;
+} poolJob;
+
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t poolWake = PTHREAD_COND_INITIALIZER;
+poolJob **poolJobs = NULL;
+size_t poolJobsLen = 0;
+size_t poolJobsCap = 0;
+size_t poolSize = 0;
+
+// Called and returns with poolLock held
+void poolRun(poolJob *job) {
+    pthread_mutex_unlock(&poolLock);
+
+    evalStats outerRun = runStats;
+    evalStats outerLast = lastStats;
+    evalStats outerTotal = totalStats;
+    int outerMode = evalMode;
+    arena *prev = arenaEnter(NULL);
+
+    runStats = (evalStats){0};
+    totalStats = (evalStats){0};
+    evalMode = job->mode;
+    job->run(job);
+    evalStats stats = runStats;
+    addStats(&stats, totalStats);
+
+    arenaLeave(prev);
+    evalMode = outerMode;
+    runStats = outerRun;
+    lastStats = outerLast;
+    totalStats = outerTotal;
+
+    pthread_mutex_lock(&poolLock);
+    addStats(&job->group->stats, stats);
+    if(--(job->group->pending) == 0) pthread_cond_broadcast(&poolWake);
+}
+
+void *poolWorker(void *unused) {
+    (void)unused;
+
+    pthread_mutex_lock(&poolLock);
+    while(true) {
+        if(poolJobsLen > 0) poolRun(poolJobs[--poolJobsLen]);
+        else pthread_cond_wait(&poolWake, &poolLock);
+    }
+    return NULL;
+}
+
+// Makes sure there are workers for `threads` threads, counting the caller,
+// who helps while it waits. 0 means one per core
+void poolStart(size_t threads) {
+    if(threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    pthread_mutex_lock(&poolLock);
+    while(poolSize + 1 < threads) {
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, poolWorker, NULL) != 0) {
+            printf("Couldn't start an evaluation thread\n");
+            exit(1);
+        }
+        pthread_detach(thread);
+        poolSize++;
+    }
+    pthread_mutex_unlock(&poolLock);
+}
+
+void poolPush(poolJob *job) {
+    pthread_mutex_lock(&poolLock);
+    if(poolJobsLen == poolJobsCap) {
+        poolJobsCap = poolJobsCap * 2 + 16;
+        poolJobs = Realloc(poolJobs, poolJobsCap * sizeof(poolJob *));
+    }
+    poolJobs[poolJobsLen++] = job;
+    pthread_cond_broadcast(&poolWake);
+    pthread_mutex_unlock(&poolLock);
+}
+
+void poolWait(poolGroup *group) {
+    pthread_mutex_lock(&poolLock);
+    while(group->pending > 0) {
+        if(poolJobsLen > 0) poolRun(poolJobs[--poolJobsLen]);
+        else pthread_cond_wait(&poolWake, &poolLock);
+    }
+    pthread_mutex_unlock(&poolLock);
+}
+
+void batchRun(poolJob *job) {
+    evaluate(job->term);
+}
+
+void evaluateBatch(expr *terms, size_t count, size_t threads) {
+    poolStart(threads);
+
+    poolGroup group = { .pending = count };
+    poolJob *jobs = Malloc(count * sizeof(poolJob));
+    for(size_t i = 0; i < count; i++) {
+        terms[i] = termDetach(terms[i]);
+        jobs[i] = (poolJob){ .run = batchRun, .term = &terms[i], .mode = evalMode, .group = &group };
+        poolPush(&jobs[i]);
+    }
+    poolWait(&group);
+    Free(jobs);
+
+    addStats(&totalStats, group.stats);
+}
+
+// ==================
+// PARALLEL REDUCTION
+// ==================
+
+// EVAL_PARALLEL is normal order (evaluateSingle) PAR_SLICE steps at a time,
+// so a term that takes fewer never leaves the thread. Between slices it walks
+// down from the root through what normal order will never rewrite again:
+// functions, and applications headed by a variable or an impure value. The
+// arguments hanging off those are independent. If two or more of them still
+// have redexes, each becomes a job on the pool (see CONTEXTS) that does the
+// same, and their normal forms are spliced back into the term. Normal order
+// would reach the same normal form one argument after the other
+
+#define PAR_SLICE 512
+
+int64_t parallelJobs = 0;
+
+void parallelNormalize(expr *e);
+
+void parallelRun(poolJob *job) {
+    parallelNormalize(job->term);
+}
+
+typedef struct {
+    size_t pos;
+    size_t len;
+    expr result;
+} parallelLeaf;
 
-    while(depth > 0) {
+// Whether normal order has anything left to do in the `len` bytes at `data`
+bool parallelHasRedex(byte *data, size_t len) {
+    byte *end = data + len;
+
+    while(data < end) {
         exprType type = *(exprType *)data;
 
         if(false) {}
         else if(isBind(type)) {
-            data += sizeof(bindt);
-
-            depth--;
-            continue;
+            data += BIND_LEN;
         }
         else if(type == EXPR_FUN) {
-            data += sizeof(exprType);
-            bindt bind = *(bindt *)data;
-            var(newBind);
-            *(bindt *)data = newBind;
-            data += sizeof(bindt);
-
-            byte *sdata = data;
-            replaceBindings(bind, newBind, &sdata);
-
-            depth += 1;
-            depth--;
-            continue;
+            data += FUN_LEN;
         }
         else if(type == EXPR_APP) {
+            byte *lhs = data + sizeof(exprType);
+            if(*(exprType *)lhs == EXPR_FUN || *(exprType *)lhs == EXPR_REF) return true;
+            if(*(exprType *)lhs == EXPR_IMPURE_FUN && *(exprType *)(lhs + IMPURE_FUN_LEN) == EXPR_IMPURE_VAL) return true;
             data += sizeof(exprType);
-
-            depth += 2;
-            depth--;
-            continue;
         }
         else if(type == EXPR_IMPURE_VAL) {
-            data += sizeof(exprType);
-            size_t vlen = *(size_t *)data;
-            data += sizeof(size_t);
-            data += vlen;
-
-            depth--;
-            continue;
+            data += impureValLen(data);
         }
         else if(type == EXPR_IMPURE_FUN) {
-            data += sizeof(exprType);
-            data += sizeof(impureFunpt);
-
-            depth--;
-            continue;
+            data += IMPURE_FUN_LEN;
+        }
+        else if(type == EXPR_REF) {
+            if(!sharedAt(data + sizeof(exprType))->normal) return true;
+            data += REF_LEN;
         }
     }
-}
 
-void evaluate(expr *e) {
-    replaceList list = mkrl();
+    return false;
+}
 
-    byte *odata = e->data;
-    byte *data = e->data;
+// The independent subterms of `e` that still have redexes, in order
+size_t parallelLeaves(expr e, parallelLeaf **leaves) {
+    uint32_t *lens = termAlloc(e.len * sizeof(uint32_t));
+    indexStack stack = mkix();
+    buildLenIndex(e.data, e.len, lens, &stack);
+
+    size_t count = 0;
+    size_t cap = 16;
+    *leaves = termAlloc(cap * sizeof(parallelLeaf));
+
+    stack.len = 0;
+    ixpush(&stack, (indexFrame){ .pos = 0 });
+    while(stack.len > 0) {
+        size_t pos = stack.items[--stack.len].pos;
+        byte *data = e.data + pos;
+        exprType type = *(exprType *)data;
 
-    size_t rpos;
-    size_t rlen;
+        size_t head = pos;
+        while(*(exprType *)(e.data + head) == EXPR_APP) head += sizeof(exprType);
+        exprType headType = *(exprType *)(e.data + head);
 
-    size_t fpos;
-    size_t flen;
+        if(type == EXPR_FUN) {
+            ixpush(&stack, (indexFrame){ .pos = pos + FUN_LEN });
+            continue;
+        }
+        if(type == EXPR_APP && (isBind(headType) || headType == EXPR_IMPURE_VAL)) {
+            // The outermost application's argument is the last one
+            for(size_t app = pos; app < head; app += sizeof(exprType)) {
+                size_t lhs = app + sizeof(exprType);
+                ixpush(&stack, (indexFrame){ .pos = lhs + lens[lhs] });
+            }
+            continue;
+        }
+        if(!parallelHasRedex(data, lens[pos])) continue;
+
+        if(count == cap) {
+            parallelLeaf *nleaves = termAlloc(cap * 2 * sizeof(parallelLeaf));
+            memcpy(nleaves, *leaves, count * sizeof(parallelLeaf));
+            termFree(*leaves);
+            *leaves = nleaves;
+            cap *= 2;
+        }
+        (*leaves)[count++] = (parallelLeaf){ .pos = pos, .len = lens[pos] };
+    }
 
-    impureFunpt imfun = NULL;
+    ixfree(stack);
+    termFree(lens);
+    return count;
+}
 
-    while(scanForSubst(odata, &data, &list, &rpos, &rlen, &fpos, &flen, &imfun)) {
-        bool useImpureFunction = imfun != NULL;
-        size_t imrlen = rlen;
+void parallelNormalize(expr *e) {
+    while(true) {
+        fuelSteps = runStats.betaSteps + runStats.impureCalls + runStats.sharedCopies + PAR_SLICE;
+        fuelExhausted = false;
+        evaluateSingle(e);
+        bool normal = !fuelExhausted;
+        fuelSteps = -1;
+        fuelExhausted = false;
+        if(normal) return;
+
+        parallelLeaf *leaves;
+        size_t count = parallelLeaves(*e, &leaves);
+        if(count < 2) {
+            termFree(leaves);
+            continue;
+        }
 
-        byte *rdata = Malloc(rlen);
-        memcpy(rdata, e->data + rpos, rlen);
+        poolGroup group = { .pending = count };
+        poolJob *jobs = termAlloc(count * sizeof(poolJob));
+        for(size_t i = 0; i < count; i++) {
+            parallelLeaf *leaf = &leaves[i];
+            leaf->result = (expr){ .data = Malloc(leaf->len), .len = leaf->len };
+            memcpy(leaf->result.data, e->data + leaf->pos, leaf->len);
 
-        if(useImpureFunction) {
-            expr impureResult = imfun(rdata, rlen);
-            Free(rdata);
-            rdata = impureResult.data;
-            imrlen = impureResult.len;
+            jobs[i] = (poolJob){ .run = parallelRun, .term = &leaf->result, .mode = evalMode, .group = &group };
+            poolPush(&jobs[i]);
         }
-
-        if(!useImpureFunction) {
-            byte *_rdata = rdata;
-            makeUniqueBindings(_rdata);
+        __atomic_add_fetch(&parallelJobs, count, __ATOMIC_RELAXED);
+        poolWait(&group);
+        addStats(&runStats, group.stats);
+
+        size_t newLen = e->len;
+        for(size_t i = 0; i < count; i++) newLen += leaves[i].result.len - leaves[i].len;
+
+        byte *ndata = termAlloc(newLen);
+        size_t from = 0;
+        size_t to = 0;
+        for(size_t i = 0; i < count; i++) {
+            parallelLeaf *leaf = &leaves[i];
+            memcpy(ndata + to, e->data + from, leaf->pos - from);
+            to += leaf->pos - from;
+            memcpy(ndata + to, leaf->result.data, leaf->result.len);
+            to += leaf->result.len;
+            from = leaf->pos + leaf->len;
+            termFree(leaf->result.data);
         }
+        memcpy(ndata + to, e->data + from, e->len - from);
 
-        size_t extraBytesPerBind = (imrlen - sizeof(bindt));
-        size_t oldLen = e->len;
-        size_t newLen = e->len + extraBytesPerBind * list.len - rlen - flen;
+        runStats.bytesMoved += newLen;
+        if(newLen > runStats.peakLen) runStats.peakLen = newLen;
 
-        memmove(e->data + rpos, e->data + rpos + rlen, e->len - (rpos + rlen)); 
-        memmove(e->data + fpos, e->data + fpos + flen, e->len - (fpos + flen)); 
-        e->data = Realloc(e->data, newLen);
+        termFree(e->data);
+        e->data = ndata;
         e->len = newLen;
-        odata = e->data;
-
-        size_t extra = 0;
-        for(size_t i = 0; i < list.len; i++) {
-            size_t offset = list.offsets[i] - flen + extra;
-            size_t toMove = oldLen + extra - offset - flen - rlen - sizeof(bindt);
-            extra += extraBytesPerBind;
-
-            memmove(odata + offset + sizeof(bindt) + extraBytesPerBind, odata + offset + sizeof(bindt), toMove);
-
-            memcpy(odata + offset, rdata, imrlen);
-        }
-
-        Free(rdata);
-        list.len = 0;
-        odata = e->data;
-        data = e->data;
-        imfun = NULL;
+        termFree(jobs);
+        termFree(leaves);
+        return;
     }
+}
 
-    rlfree(list);
+void evaluateParallel(expr *e) {
+    poolStart(0);
+    parallelNormalize(e);
 }
 
 // ==================
@@ -519,76 +5942,120 @@ void evaluate(expr *e) {
 // ==================
 
 expr mkBind(bindt bind) {
-    size_t len = sizeof(bindt);
-    expr b = { .aux = true, .data = Malloc(len), .len = len };
-    *(bindt *)b.data = bind;
+    size_t len = BIND_LEN;
+    expr b = { .aux = true, .data = termAlloc(len), .len = len };
+    *(exprType *)b.data = EXPR_BIND;
+    writeField(bindt, b.data + sizeof(exprType), bind);
     return b;
 }
 
-expr mkFun(bindt bind, expr body) {
-    size_t len = sizeof(exprType) + sizeof(bindt) + body.len;
-    expr b = { .aux = true, .data = Malloc(len), .len = len };
-    byte *data = b.data;
+// Terms are written in pre-order into one growable buffer: App and Fun open
+// a node, their operands are put in place after it, and the outermost node
+// hands out the finished term. Operands built by App, Fun or Bind while the
+// builder is open are already in place and come back as a marker with no data
 
-    *(exprType *)data = EXPR_FUN;
-    data += sizeof(exprType);
+typedef struct {
+    byte *data;
+    size_t len;
+    size_t cap;
+    size_t depth;
+    bool pending;
+} termBuilder;
+
+_Thread_local termBuilder builder = {0};
+
+static inline void builderReserve(size_t len) {
+    if(builder.len + len > builder.cap) {
+        size_t ncap = builder.cap * 2 + len;
+        byte *ndata = termAlloc(ncap);
+        memcpy(ndata, builder.data, builder.len);
+        termFree(builder.data);
+        builder.data = ndata;
+        builder.cap = ncap;
+    }
+}
+
+// A marker has to be put into its parent before anything else is built,
+// otherwise it was built out of place
+static inline void builderCheck() {
+    if(builder.pending) {
+        printf("Term built inside App or Fun was not used in place\n");
+        exit(1);
+    }
+}
 
-    *(bindt *)data = bind;
-    data += sizeof(bindt);
+void builderEnter(exprType type, bindt bind) {
+    builderCheck();
+    if(builder.depth == 0) {
+        builder.cap = 64;
+        builder.data = termAlloc(builder.cap);
+        builder.len = 0;
+    }
+    builder.depth++;
+
+    builderReserve(FUN_LEN);
+    byte *data = builder.data + builder.len;
+    *(exprType *)data = type;
+    builder.len += sizeof(exprType);
+    if(type == EXPR_FUN || isBind(type)) {
+        writeField(bindt, data + sizeof(exprType), bind);
+        builder.len += sizeof(bindt);
+    }
+}
 
-    memcpy(data, body.data, body.len);
-    byte *p = data;
-    makeUniqueBindings(p);
+expr builderLeave() {
+    builder.depth--;
+    if(builder.depth > 0) {
+        builder.pending = true;
+        return (expr){0};
+    }
 
-    maybeFree(body);
-    return b;
+    expr e = { .aux = true, .data = builder.data, .len = builder.len };
+    builder.data = NULL;
+    builder.len = builder.cap = 0;
+    return e;
 }
 
-expr mkApp(expr lhs, expr rhs) {
-    size_t len = sizeof(exprType) + lhs.len + rhs.len;
-    expr b = { .aux = true, .data = Malloc(len), .len = len };
-    byte *data = b.data;
+// Copies e after the open node, with fresh binders for its lambdas
+void builderPut(expr e) {
+    if(e.data == NULL) {
+        builder.pending = false;
+        return;
+    }
+    builderCheck();
 
-    *(exprType *)data = EXPR_APP;
-    data += sizeof(exprType);
+    builderReserve(e.len);
+    byte *data = builder.data + builder.len;
+    memcpy(data, e.data, e.len);
+    builder.len += e.len;
+    maybeFree(e);
 
-    memcpy(data, lhs.data, lhs.len);
-    byte *p = data;
-    makeUniqueBindings(p);
-    data += lhs.len;
-
-    memcpy(data, rhs.data, rhs.len);
-    p = data;
-    makeUniqueBindings(p);
-    
-    maybeFree(lhs);
-    maybeFree(rhs);
-    return b;
+    makeUniqueBindings(data);
 }
 
 expr mkImpureVal(byte *value, size_t vlen) {
-    size_t len = sizeof(exprType) + sizeof(size_t) + vlen;
-    expr b = { .aux = false, .data = Malloc(len), .len = len };
+    size_t len = sizeof(exprType) + sizeof(vlent) + vlen;
+    expr b = { .aux = false, .data = termAlloc(len), .len = len };
     byte *data = b.data;
 
     *(exprType *)data = EXPR_IMPURE_VAL;
     data += sizeof(exprType);
 
-    *(size_t *)data = vlen;
-    data += sizeof(size_t);
+    writeField(vlent, data, vlen);
+    data += sizeof(vlent);
 
     memcpy(data, value, vlen);
     return b;
 }
 
 expr mkImpureFun(impureFunpt fun) {
-    size_t len = sizeof(exprType) + sizeof(impureFunpt);
-    expr b = { .aux = false, .data = Malloc(len), .len = len };
+    size_t len = IMPURE_FUN_LEN;
+    expr b = { .aux = false, .data = termAlloc(len), .len = len };
     byte *data = b.data;
 
     *(exprType *)data = EXPR_IMPURE_FUN;
     data += sizeof(exprType);
-    *(impureFunpt *)data = fun;
+    writeField(impureId, data, registerImpure(fun));
 
     return b;
 }
@@ -613,12 +6080,13 @@ void _printExpr(byte **data, bindt binds[], size_t *lastBind, char symbols[], bo
 
     if(false) {}
     else if(isBind(type)) {
-        *data += sizeof(bindt);
-        printf("%c", getBindSymbol((bindt)type, binds, lastBind, symbols, bindsAmount));
+        bindt bind = readField(bindt, *data + sizeof(exprType));
+        *data += BIND_LEN;
+        printf("%c", getBindSymbol(bind, binds, lastBind, symbols, bindsAmount));
     }
     else if(type == EXPR_FUN) {
         *data += sizeof(exprType);
-        bindt bind = *(bindt *)*data;
+        bindt bind = readField(bindt, *data);
         printf("( λ%c.", getBindSymbol(bind, binds, lastBind, symbols, bindsAmount));
         *data += sizeof(bindt);
         _printExpr(data, binds, lastBind, symbols, false, bindsAmount);
@@ -633,16 +6101,20 @@ void _printExpr(byte **data, bindt binds[], size_t *lastBind, char symbols[], bo
     }
     else if(type == EXPR_IMPURE_VAL) {
         *data += sizeof(exprType);
-        size_t vlen = *(size_t *)*data;
-        printf("[%lu bytes]", vlen);
-        *data += sizeof(size_t);
+        vlent vlen = readField(vlent, *data);
+        printf("[%u bytes]", vlen);
+        *data += sizeof(vlent);
         *data += vlen;
     }
     else if(type == EXPR_IMPURE_FUN) {
-        *data += sizeof(exprType);
-        *data += sizeof(impureFunpt);
+        *data += IMPURE_FUN_LEN;
         printf("<fun>");
     }
+    else if(type == EXPR_REF) {
+        byte *sdata = sharedAt(*data + sizeof(exprType))->term.data;
+        *data += REF_LEN;
+        _printExpr(&sdata, binds, lastBind, symbols, isRhs, bindsAmount);
+    }
 }
 
 void printExpr(expr e) {
@@ -654,44 +6126,473 @@ void printExpr(expr e) {
     printf("\n");
 }
 
+// ==================
+// PRELUDE IMAGE
+// ==================
+
+// Built with PRELUDE_IMAGE, main keeps the evaluated prelude in that file.
+// Definitions made between imageOpen and imageClose are recorded and written
+// out with every shared term on close; the next run maps the file and those
+// definitions point into it instead of being built and evaluated again.
+// The image is only loaded before anything is shared, so refIds are the ones
+// it was written with. Impure functions are stored by name (see DefunImpure)
+// and looked up again, the nodes that mention one are only patched when its
+// id changed. An image that doesn't fit this build is ignored and written
+// again. Every definition also keeps a hash of its source text: from the
+// first one that changed or isn't in the image on, definitions are built
+// again, since they may use it, and imageClose removes the file so the next
+// run writes it afresh. Changes to C code a definition calls (Church, say)
+// aren't seen, so remove the file after those
+
+#define IMAGE_MAGIC "LAMBDAIM"
+#define IMAGE_VERSION 2
+
+// Field widths, so an image from a build with other types is refused. Being
+// read in native byte order, it also refuses one from another byte order
+#define IMAGE_LAYOUT ((uint32_t)(sizeof(exprType) | sizeof(bindt) << 4 | sizeof(vlent) << 8 | sizeof(impureId) << 12 | sizeof(refId) << 16))
+
+// Offsets are from the start of the file, and `hash` covers everything after
+// the header, so a damaged file is refused. The header is followed by the
+// shared terms, the definitions, the impure function names (0 for one without
+// a name) and the offsets of the impureId of every EXPR_IMPURE_FUN node, all
+// 8 byte aligned, then the terms and names themselves
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    uint64_t size;
+    uint64_t hash;
+    uint64_t shared;
+    uint64_t defs;
+    uint64_t impures;
+    uint64_t relocs;
+    uint32_t sharedCount;
+    uint32_t defCount;
+    uint32_t impureCount;
+    uint32_t relocCount;
+} imageHeader;
+
+typedef struct {
+    uint64_t term;
+    uint64_t canon;
+    uint64_t hash;
+    uint32_t termLen;
+    uint32_t canonLen;
+    uint64_t normal;
+} imageShared;
+
+typedef struct {
+    uint64_t name;
+    uint64_t source;
+    uint64_t value;
+    uint64_t len;
+} imageDef;
+
+typedef struct {
+    const char *name;
+    uint64_t source;
+    expr value;
+} imageEntry;
+
+typedef struct {
+    byte *data;
+    size_t len;
+    size_t cap;
+} imageBuffer;
+
+const char *imagePath = NULL;
+
+// The mapping stays for the rest of the run, imageDefs only until imageClose
+byte *imageData = NULL;
+imageDef *imageDefs = NULL;
+uint32_t imageDefCount = 0;
+uint32_t imageNext = 0;
+
+bool imageRecording = false;
+bool imageStale = false;
+imageEntry *imageEntries = NULL;
+size_t imageEntriesLen = 0;
+size_t imageEntriesCap = 0;
+
+size_t imagePut(imageBuffer *b, const void *src, size_t len) {
+    if(b->len + len > b->cap) {
+        b->cap = (b->len + len) * 2;
+        b->data = Realloc(b->data, b->cap);
+    }
+
+    size_t off = b->len;
+    if(src != NULL) memcpy(b->data + off, src, len);
+    else memset(b->data + off, 0, len);
+    b->len += len;
+    return off;
+}
+
+#define imageAlign(b) imagePut((b), NULL, -(b)->len & 7)
+
+// Whether the `len` bytes at `off` lie inside an image of `size` bytes
+#define imageFits(off, len, size) ((off) <= (size) && (len) <= (size) - (off))
+
+// Whether a NUL terminated string starts at `off` and ends inside the image
+#define imageString(data, off, size) ((off) < (size) && memchr((data) + (off), 0, (size) - (off)) != NULL)
+
+// Whether the `len` bytes at `data` are exactly one term whose impure
+// functions are all in impureTable and that only refers to the first `shared`
+// shared terms
+bool imageTermFits(byte *data, size_t len, refId shared) {
+    size_t pending = 1;
+    size_t pos = 0;
+
+    while(pending > 0) {
+        if(len - pos < sizeof(exprType)) return false;
+
+        byte *node = data + pos;
+        exprType type = *(exprType *)node;
+        if(type > EXPR_REF) return false;
+        if(type == EXPR_IMPURE_VAL && len - pos < sizeof(exprType) + sizeof(vlent)) return false;
+
+        size_t nlen = type == EXPR_FUN ? FUN_LEN : dbNodeLen(node);
+        if(nlen > len - pos) return false;
+        if(type == EXPR_IMPURE_FUN && readField(impureId, node + sizeof(exprType)) >= impureCount) return false;
+        if(type == EXPR_REF && readField(refId, node + sizeof(exprType)) >= shared) return false;
+
+        pending = pending - 1 + dbChildren(type);
+        pos += nlen;
+    }
+
+    return pos == len;
+}
+
+// Maps the image at `path` and takes the shared terms from it. Returns false,
+// leaving everything as it was, when there is none or it doesn't fit
+bool imageLoad(const char *path) {
+    if(sharedCount != 0) return false;
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(imageHeader)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    byte *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return false;
+
+    // The hash catches a damaged file, but nothing in it is trusted either:
+    // every table, term and name has to lie inside it, with the tables
+    // aligned for reading them in place
+    imageHeader *h = (imageHeader *)data;
+    bool fits = memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) == 0 && h->version == IMAGE_VERSION && h->layout == IMAGE_LAYOUT && h->size == size;
+    fits = fits && h->hash == hashBytes(data + sizeof(imageHeader), size - sizeof(imageHeader));
+    fits = fits && h->impureCount <= IMPURE_MAX && ((h->shared | h->defs | h->impures | h->relocs) & 7) == 0;
+    fits = fits && imageFits(h->shared, h->sharedCount * sizeof(imageShared), size);
+    fits = fits && imageFits(h->defs, h->defCount * sizeof(imageDef), size);
+    fits = fits && imageFits(h->impures, h->impureCount * sizeof(uint64_t), size);
+    fits = fits && imageFits(h->relocs, h->relocCount * sizeof(uint64_t), size);
+    if(!fits) {
+        munmap(data, size);
+        return false;
+    }
+
+    imageShared *shared = (imageShared *)(data + h->shared);
+    imageDef *defs = (imageDef *)(data + h->defs);
+    uint64_t *names = (uint64_t *)(data + h->impures);
+    uint64_t *relocs = (uint64_t *)(data + h->relocs);
+
+    for(uint32_t i = 0; fits && i < h->sharedCount; i++) {
+        fits = imageFits(shared[i].term, shared[i].termLen, size) && imageFits(shared[i].canon, shared[i].canonLen, size);
+    }
+    for(uint32_t i = 0; fits && i < h->defCount; i++) {
+        fits = imageString(data, defs[i].name, size) && imageFits(defs[i].value, defs[i].len, size);
+    }
+    for(uint32_t i = 0; fits && i < h->impureCount; i++) {
+        fits = names[i] == 0 || imageString(data, names[i], size);
+    }
+
+    // Patching an id mustn't change the tables checked above
+    uint64_t terms = h->impures + h->impureCount * sizeof(uint64_t);
+    if(terms < h->shared + h->sharedCount * sizeof(imageShared)) terms = h->shared + h->sharedCount * sizeof(imageShared);
+    if(terms < h->defs + h->defCount * sizeof(imageDef)) terms = h->defs + h->defCount * sizeof(imageDef);
+    for(uint32_t i = 0; fits && i < h->relocCount; i++) {
+        fits = relocs[i] >= terms && imageFits(relocs[i], sizeof(impureId), h->relocs);
+    }
+
+    if(!fits) {
+        munmap(data, size);
+        return false;
+    }
+
+    // Impure functions by name, IMPURE_MAX for one this build doesn't have
+    impureId ids[IMPURE_MAX];
+    for(uint32_t i = 0; i < h->impureCount; i++) {
+        ids[i] = IMPURE_MAX;
+        for(impureId j = 0; j < impureCount && names[i] != 0; j++) {
+            if(impureNames[j] != NULL && strcmp(impureNames[j], (char *)data + names[i]) == 0) ids[i] = j;
+        }
+    }
+
+    // Pages are only copied when an id has to change
+    for(uint32_t i = 0; i < h->relocCount; i++) {
+        byte *field = data + relocs[i];
+        impureId id = readField(impureId, field);
+        if(id >= h->impureCount || ids[id] == IMPURE_MAX) {
+            munmap(data, size);
+            return false;
+        }
+        if(ids[id] != id) writeField(impureId, field, ids[id]);
+    }
+
+    // Only checked now, with the impure functions renumbered for this build.
+    // A shared term only refers to the ones shared before it, and its de
+    // Bruijn form is made again to compare, since the machines index their
+    // environments with it
+    for(uint32_t i = 0; fits && i < h->sharedCount; i++) {
+        expr term = { .data = data + shared[i].term, .len = shared[i].termLen, .aux = false };
+        fits = imageTermFits(term.data, term.len, i);
+        if(!fits) break;
+
+        bool closed = true;
+        expr canon = toDeBruijn(term, &closed);
+        fits = closed && canon.len == shared[i].canonLen && memcmp(canon.data, data + shared[i].canon, canon.len) == 0;
+        fits = fits && shared[i].hash == hashBytes(canon.data, canon.len);
+        termFree(canon.data);
+    }
+    for(uint32_t i = 0; fits && i < h->defCount; i++) {
+        fits = imageTermFits(data + defs[i].value, defs[i].len, h->sharedCount);
+    }
+
+    if(!fits) {
+        munmap(data, size);
+        return false;
+    }
+    mprotect(data, size, PROT_READ);
+
+    if(h->sharedCount > sharedCap) {
+        sharedCap = h->sharedCount;
+        sharedTable = Realloc(sharedTable, sharedCap * sizeof(sharedTerm));
+    }
+    while((size_t)(h->sharedCount + 1) * 2 > sharedSlotsCap) sharedGrow();
+
+    for(uint32_t i = 0; i < h->sharedCount; i++) {
+        sharedTerm *s = &sharedTable[i];
+        s->term = (expr){ .data = data + shared[i].term, .len = shared[i].termLen, .aux = false };
+        s->canon = (expr){ .data = data + shared[i].canon, .len = shared[i].canonLen, .aux = false };
+        s->hash = shared[i].hash;
+        s->normal = shared[i].normal;
+
+        sharedSlots[sharedFind(s->canon, s->hash)] = ++sharedCount;
+    }
+
+    imageData = data;
+    imageDefs = defs;
+    imageDefCount = h->defCount;
+    imageNext = 0;
+    return true;
+}
+
+// Appends the EXPR_IMPURE_FUN nodes of the term at `off` to `relocs`. Returns
+// false when one of them has no name
+bool imageRelocs(imageBuffer *b, imageBuffer *relocs, size_t off, size_t len, bool db) {
+    for(size_t pos = 0; pos < len;) {
+        byte *node = b->data + off + pos;
+        exprType type = *(exprType *)node;
+
+        if(type == EXPR_IMPURE_FUN) {
+            if(impureNames[readField(impureId, node + sizeof(exprType))] == NULL) return false;
+            uint64_t field = off + pos + sizeof(exprType);
+            imagePut(relocs, &field, sizeof(field));
+        }
+
+        pos += !db && type == EXPR_FUN ? FUN_LEN : dbNodeLen(node);
+    }
+
+    return true;
+}
+
+void imageSave(const char *path) {
+    imageBuffer b = {0};
+    imageBuffer relocs = {0};
+
+    size_t header = imagePut(&b, NULL, sizeof(imageHeader));
+    size_t shared = imagePut(&b, NULL, sharedCount * sizeof(imageShared));
+    size_t defs = imagePut(&b, NULL, imageEntriesLen * sizeof(imageDef));
+    size_t impures = imagePut(&b, NULL, impureCount * sizeof(uint64_t));
+
+    bool named = true;
+    for(refId i = 0; i < sharedCount; i++) {
+        sharedTerm *s = &sharedTable[i];
+        size_t term = imagePut(&b, s->term.data, s->term.len);
+        size_t canon = imagePut(&b, s->canon.data, s->canon.len);
+        named = named && imageRelocs(&b, &relocs, term, s->term.len, false) && imageRelocs(&b, &relocs, canon, s->canon.len, true);
+
+        ((imageShared *)(b.data + shared))[i] = (imageShared){
+            .term = term,
+            .canon = canon,
+            .hash = s->hash,
+            .termLen = s->term.len,
+            .canonLen = s->canon.len,
+            .normal = s->normal,
+        };
+    }
+
+    for(size_t i = 0; i < imageEntriesLen; i++) {
+        imageEntry *e = &imageEntries[i];
+        size_t name = imagePut(&b, e->name, strlen(e->name) + 1);
+        size_t value = imagePut(&b, e->value.data, e->value.len);
+        named = named && imageRelocs(&b, &relocs, value, e->value.len, false);
+
+        ((imageDef *)(b.data + defs))[i] = (imageDef){ .name = name, .source = e->source, .value = value, .len = e->value.len };
+    }
+
+    for(impureId i = 0; i < impureCount; i++) {
+        size_t name = impureNames[i] == NULL ? 0 : imagePut(&b, impureNames[i], strlen(impureNames[i]) + 1);
+        ((uint64_t *)(b.data + impures))[i] = name;
+    }
+
+    imageAlign(&b);
+    size_t relocsOff = imagePut(&b, relocs.data, relocs.len);
+
+    imageHeader *h = (imageHeader *)(b.data + header);
+    memcpy(h->magic, IMAGE_MAGIC, sizeof(h->magic));
+    h->version = IMAGE_VERSION;
+    h->layout = IMAGE_LAYOUT;
+    h->size = b.len;
+    h->hash = hashBytes(b.data + sizeof(imageHeader), b.len - sizeof(imageHeader));
+    h->shared = shared;
+    h->defs = defs;
+    h->impures = impures;
+    h->relocs = relocsOff;
+    h->sharedCount = sharedCount;
+    h->defCount = imageEntriesLen;
+    h->impureCount = impureCount;
+    h->relocCount = relocs.len / sizeof(uint64_t);
+
+    // Written aside and renamed, so another run never maps half an image
+    char temp[4096];
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+
+    FILE *file = NULL;
+    if(!named) {
+        printf("The prelude mentions an impure function without a name, %s is not written\n", path);
+    }
+    else if((file = fopen(temp, "wb")) == NULL || fwrite(b.data, 1, b.len, file) != b.len) {
+        printf("Could not write the prelude image %s\n", path);
+        if(file != NULL) fclose(file);
+        remove(temp);
+    }
+    else if(fclose(file) != 0 || rename(temp, path) != 0) {
+        printf("Could not write the prelude image %s\n", path);
+        remove(temp);
+    }
+
+    Free(b.data);
+    Free(relocs.data);
+}
+
+// Definitions after this take their value from the image at `path` if there
+// is one, and are recorded for it otherwise
+void imageOpen(const char *path) {
+    imagePath = path;
+    imageRecording = !imageLoad(path);
+}
+
+void imageClose() {
+    if(false) {}
+    else if(imageRecording) imageSave(imagePath);
+    else if(imageStale)     remove(imagePath);
+
+    imageRecording = false;
+    imageStale = false;
+    imageDefs = NULL;
+    imageDefCount = 0;
+
+    Free(imageEntries);
+    imageEntries = NULL;
+    imageEntriesLen = 0;
+    imageEntriesCap = 0;
+}
+
+// Looks `name` up in the image, trying the definition after the last one
+// found first since they come in the same order. `source` is the text it was
+// defined with
+bool imageFind(const char *name, const char *source, expr *value) {
+    if(imageDefCount == 0) return false;
+
+    uint64_t hash = hashBytes((byte *)source, strlen(source));
+    for(uint32_t n = 0; n < imageDefCount; n++) {
+        imageDef *d = &imageDefs[(imageNext + n) % imageDefCount];
+        if(strcmp((char *)imageData + d->name, name) != 0) continue;
+        if(d->source != hash) break;
+
+        *value = (expr){ .data = imageData + d->value, .len = d->len, .aux = false };
+        imageNext = (imageNext + n + 1) % imageDefCount;
+        return true;
+    }
+
+    // The definitions after this one may be built on it
+    imageStale = true;
+    imageDefCount = 0;
+    return false;
+}
+
+void imageKeep(const char *name, const char *source, expr value) {
+    if(!imageRecording) return;
+
+    if(imageEntriesLen == imageEntriesCap) {
+        imageEntriesCap = imageEntriesCap * 2 + 16;
+        imageEntries = Realloc(imageEntries, imageEntriesCap * sizeof(imageEntry));
+    }
+    imageEntries[imageEntriesLen++] = (imageEntry){ .name = name, .source = hashBytes((byte *)source, strlen(source)), .value = value };
+}
+
 // ==================
 // MACROS / EXPRESSIONS
 // ==================
 
-#define Bind(bi) mkBind(bi)
+// Inside App or Fun a binder is written in place, on its own it gets a term
+#define Bind(bi) (builder.depth > 0 ? (builderEnter(EXPR_BIND, bi), builderLeave()) : mkBind(bi))
 
 expr Church(size_t num) {
     var(s);
     var(z);
-    size_t allocSize = sizeof(exprType) + sizeof(bindt) +
-                       sizeof(exprType) + sizeof(bindt) +
-                       num * (sizeof(exprType) + sizeof(bindt)) +
-                       sizeof(bindt);
+    size_t allocSize = FUN_LEN +
+                       FUN_LEN +
+                       num * (sizeof(exprType) + BIND_LEN) +
+                       BIND_LEN;
 
-    byte *data = Malloc(allocSize);
+    byte *data = termAlloc(allocSize);
     byte *sdata = data;
 
     *(exprType *)sdata = EXPR_FUN;
     sdata += sizeof(exprType);
 
-    *(bindt *)sdata = s;
+    writeField(bindt, sdata, s);
     sdata += sizeof(bindt);
 
     *(exprType *)sdata = EXPR_FUN;
     sdata += sizeof(exprType);
 
-    *(bindt *)sdata = z;
+    writeField(bindt, sdata, z);
     sdata += sizeof(bindt);
 
     for(size_t i = 0; i < num; i++) {
         *(exprType *)sdata = EXPR_APP;
         sdata += sizeof(exprType);
 
-        *(bindt *)sdata = s;
+        *(exprType *)sdata = EXPR_BIND;
+        sdata += sizeof(exprType);
+
+        writeField(bindt, sdata, s);
         sdata += sizeof(bindt);
     }
 
-    *(bindt *)sdata = z;
+    *(exprType *)sdata = EXPR_BIND;
+    sdata += sizeof(exprType);
+
+    writeField(bindt, sdata, z);
     sdata += sizeof(bindt);
 
     return (expr){ .data = data, .len = allocSize, .aux = true };
@@ -700,118 +6601,274 @@ expr Church(size_t num) {
 #define App(l, r) \
     {0}; \
     { \
-        expr __lhs; \
+        builderEnter(EXPR_APP, 0); \
         { \
             expr temp = l; \
-            __lhs = temp; \
+            builderPut(temp); \
         } \
-        expr __rhs; \
         { \
             expr temp = r; \
-            __rhs = temp; \
+            builderPut(temp); \
         } \
-        temp = mkApp(__lhs, __rhs); \
+        temp = builderLeave(); \
     } \
 
 #define Fun(b, body) \
     {0}; \
     { \
         var(b); \
+        builderEnter(EXPR_FUN, b); \
         { \
-            expr __fun; \
-            { \
-                expr temp = body; \
-                __fun = temp; \
-            } \
-            temp = mkFun(b, __fun); \
+            expr temp = body; \
+            builderPut(temp); \
         } \
+        temp = builderLeave(); \
     }
 
+// Definitions are built and evaluated inside defineArena, so all the
+// intermediate terms go away at once and only the result is kept, as a
+// shared term when it is one. While a prelude image is open they are taken
+// from it by name instead when it has them with the same source
+
+arena defineArena = {0};
+
 #define Defun(fname, b, body) \
     expr fname; \
-    { \
-        var(b); \
-        expr __fun; \
+    const char *__##fname##Source = "Defun " #b ". " #body; \
+    if(!imageFind(#fname, __##fname##Source, &fname)) { \
+        arena *__prevArena = arenaEnter(&defineArena); \
         { \
-            expr temp = body; \
-            __fun = temp; \
+            var(b); \
+            builderEnter(EXPR_FUN, b); \
+            { \
+                expr temp = body; \
+                builderPut(temp); \
+            } \
+            fname = builderLeave(); \
         } \
-        fname = mkFun(b, __fun); \
+        evaluate(&fname); \
+        fname = shareTerm(fname); \
+        arenaReset(&defineArena); \
+        arenaLeave(__prevArena); \
+        imageKeep(#fname, __##fname##Source, fname); \
     } \
-    fname.aux = false; \
-    evaluate(&fname);
+    fname.aux = false;
 
 #define DefunLazy(fname, b, body) \
     expr fname; \
-    { \
-        var(b); \
-        expr __fun; \
+    const char *__##fname##Source = "DefunLazy " #b ". " #body; \
+    if(!imageFind(#fname, __##fname##Source, &fname)) { \
+        arena *__prevArena = arenaEnter(&defineArena); \
         { \
-            expr temp = body; \
-            __fun = temp; \
+            var(b); \
+            builderEnter(EXPR_FUN, b); \
+            { \
+                expr temp = body; \
+                builderPut(temp); \
+            } \
+            fname = builderLeave(); \
         } \
-        fname = mkFun(b, __fun); \
+        fname = shareTerm(fname); \
+        arenaReset(&defineArena); \
+        arenaLeave(__prevArena); \
+        imageKeep(#fname, __##fname##Source, fname); \
     } \
     fname.aux = false; \
 
 #define Defvar(vname, body) \
     expr vname; \
-    { \
-        expr temp = body; \
-        vname = temp; \
+    const char *__##vname##Source = "Defvar " #body; \
+    if(!imageFind(#vname, __##vname##Source, &vname)) { \
+        arena *__prevArena = arenaEnter(&defineArena); \
+        { \
+            expr temp = body; \
+            vname = temp; \
+        } \
+        evaluate(&vname); \
+        vname = shareTerm(vname); \
+        arenaReset(&defineArena); \
+        arenaLeave(__prevArena); \
+        imageKeep(#vname, __##vname##Source, vname); \
     } \
-    vname.aux = false; \
-    evaluate(&vname);
+    vname.aux = false;
 
 #define DefvarLazy(vname, body) \
+    expr vname; \
+    const char *__##vname##Source = "DefvarLazy " #body; \
+    if(!imageFind(#vname, __##vname##Source, &vname)) { \
+        arena *__prevArena = arenaEnter(&defineArena); \
+        { \
+            expr temp = body; \
+            vname = temp; \
+        } \
+        vname = shareTerm(vname); \
+        arenaReset(&defineArena); \
+        arenaLeave(__prevArena); \
+        imageKeep(#vname, __##vname##Source, vname); \
+    } \
+    vname.aux = false;
+
+// A one-off term, built like DefvarLazy but neither shared nor kept in the
+// prelude image, so nothing of it stays around once the caller frees it
+#define Query(vname, body) \
     expr vname; \
     { \
-        expr temp = body; \
-        vname = temp; \
+        arena *__prevArena = arenaEnter(&defineArena); \
+        { \
+            expr temp = body; \
+            vname = temp; \
+        } \
+        vname = termDetach(vname); \
+        arenaReset(&defineArena); \
+        arenaLeave(__prevArena); \
     } \
     vname.aux = false;
 
+// Defvar with the given strategy instead of evalMode
+#define DefvarUsing(vname, mode, body) \
+    int __##vname##Mode = evalMode; \
+    evalMode = (mode); \
+    Defvar(vname, body); \
+    evalMode = __##vname##Mode;
+
 #define DefunImpure(fname, argty, argname, body) \
     expr __##fname(byte *__##argname, size_t len) { \
         exprType type = *(exprType *)__##argname; \
         if(type != EXPR_IMPURE_VAL) { \
-            printf("Impure function expected type %d found type %lu\n", EXPR_IMPURE_VAL, type); \
+            printf("Impure function expected type %d found type %d\n", EXPR_IMPURE_VAL, type); \
             exit(1); \
         } \
         __##argname += sizeof(exprType); \
-        __##argname += sizeof(size_t); \
+        __##argname += sizeof(vlent); \
         len -= sizeof(exprType); \
-        len -= sizeof(size_t); \
+        len -= sizeof(vlent); \
         if(len != sizeof(argty)) { \
             printf("Impure function expected input length %lu, found length %lu\n", sizeof(argty), len); \
             exit(1); \
         } \
-        argty argname = *(argty *)__##argname; \
+        argty argname = readField(argty, __##argname); \
  \
         body; \
  \
-        argty *__result = Malloc(sizeof(argty)); \
-        *__result = argname; \
-        expr __expr = mkImpureVal((byte *)__result, sizeof(argty)); \
-        Free(__result); \
+        expr __expr = mkImpureVal((byte *)&argname, sizeof(argty)); \
         return __expr; \
     } \
-    const uint64_t __test[] = { EXPR_IMPURE_FUN, (uint64_t)__##fname }; \
-    expr fname = (expr){ .aux = false, .len = sizeof(exprType) + sizeof(impureFunpt), .data = (byte *)__test };
+    byte __##fname##Node[IMPURE_FUN_LEN] = { EXPR_IMPURE_FUN }; \
+    expr fname = (expr){ .aux = false, .len = IMPURE_FUN_LEN, .data = __##fname##Node }; \
+    __attribute__((constructor)) void __##fname##Register() { \
+        impureId __id = registerImpure(__##fname); \
+        impureNames[__id] = #fname; \
+        writeField(impureId, __##fname##Node + sizeof(exprType), __id); \
+    }
 
 #define DefvarImpure(vname, vty, vval) \
     vty *__##vname = Malloc(sizeof(vty)); \
     *__##vname = vval; \
     expr vname = mkImpureVal((byte *)__##vname, sizeof(vty));
 
-#define ReadVarImpure(var, ty) *(ty *)(var.data + sizeof(exprType) + sizeof(size_t))
+#define ReadVarImpure(var, ty) readField(ty, var.data + sizeof(exprType) + sizeof(vlent))
         
+// ==================
+// BENCHMARKS
+// ==================
+
+// Built with BENCHMARK, main runs the cases below instead of the demo tests,
+// one JSON object per line on stdout. Every case and strategy runs in its own
+// child process, so the prelude is only evaluated once, peak RSS is per case
+// and a case that runs over BENCH_TIMEOUT seconds is reported and skipped
+
+#ifdef BENCHMARK
+
+#define BENCH_TIMEOUT 10
+
+// EVAL_INET can read back a wrong normal form (see INTERACTION NETS), so it
+// only runs when built with BENCH_INET as well, on its own
+#ifdef BENCH_INET
+int benchModes[] = { EVAL_INET };
+#else
+int benchModes[] = { EVAL_SINGLE, EVAL_DEBRUIJN, EVAL_LAZY, EVAL_GRAPH, EVAL_KRIVINE, EVAL_NBE, EVAL_SKI, EVAL_NATIVE, EVAL_PARALLEL };
+#endif
+
+struct timespec benchStarted;
+int64_t benchMallocs;
+
+void benchStart() {
+    statsTiming = true;
+    benchMallocs = mallocCount;
+    alarm(BENCH_TIMEOUT);
+    clock_gettime(CLOCK_MONOTONIC, &benchStarted);
+}
+
+void benchReport(char *name, size_t n, int mode, expr result) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - benchStarted.tv_sec) + (now.tv_nsec - benchStarted.tv_nsec) / 1e9;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"bench\": \"%s\", \"n\": %lu, \"mode\": \"%s\", \"status\": \"ok\", ", name, n, evalModeName(mode));
+    if(*(exprType *)result.data == EXPR_IMPURE_VAL) printf("\"result\": %lu, ", ReadVarImpure(result, uint64_t));
+    else                                            printf("\"result\": null, ");
+    evalStats s = lastStats;
+    printf("\"wall_ms\": %.3f, \"beta_steps\": %ld, \"steps_per_sec\": %.0f, \"impure_calls\": %ld, ", seconds * 1e3, s.betaSteps, s.betaSteps / seconds, s.impureCalls);
+    printf("\"scan_passes\": %ld, \"bytes_scanned\": %ld, \"bytes_moved\": %ld, \"peak_len\": %lu, ", s.scanPasses, s.bytesScanned, s.bytesMoved, s.peakLen);
+    printf("\"scan_ms\": %.3f, \"rename_ms\": %.3f, \"splice_ms\": %.3f, ", s.scanNs / 1e6, s.renameNs / 1e6, s.spliceNs / 1e6);
+    printf("\"mallocs\": %ld, \"peak_rss_kb\": %ld}\n", mallocCount - benchMallocs, usage.ru_maxrss);
+}
+
+// EVAL_INET also reports how many interactions it took against the beta
+// steps of normal order (EVAL_KRIVINE counts the same ones), and whether both
+// agree on the result
+void benchCompare(char *name, size_t n, evalStats inet, expr result, expr reference) {
+    bool agrees = result.len == reference.len && memcmp(result.data, reference.data, result.len) == 0;
+    printf("{\"compare\": \"%s\", \"n\": %lu, \"interactions\": %ld, \"inet_beta_steps\": %ld, ", name, n, inetInteractions, inet.betaSteps);
+    printf("\"normal_order_beta_steps\": %ld, \"fallbacks\": %ld, \"agrees\": %s}\n", lastStats.betaSteps, inetFallbacks, agrees ? "true" : "false");
+}
+
+void benchFailed(char *name, size_t n, int mode, int status) {
+    char *why = WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM ? "timeout" : "failed";
+    printf("{\"bench\": \"%s\", \"n\": %lu, \"mode\": \"%s\", \"status\": \"%s\"}\n", name, n, evalModeName(mode), why);
+}
+
+// Evaluates `body` for every size in the list (bound to `n`) with every
+// strategy in benchModes
+#define Bench(name, body, ...) \
+    { \
+        size_t __sizes[] = { __VA_ARGS__ }; \
+        for(size_t __i = 0; __i < sizeof(__sizes) / sizeof(size_t); __i++) { \
+            size_t n = __sizes[__i]; \
+            for(size_t __m = 0; __m < sizeof(benchModes) / sizeof(int); __m++) { \
+                fflush(stdout); \
+                pid_t __pid = fork(); \
+                if(__pid == 0) { \
+                    evalMode = benchModes[__m]; \
+                    benchStart(); \
+                    Defvar(__result, body); \
+                    benchReport(name, n, evalMode, __result); \
+                    if(evalMode == EVAL_INET) { \
+                        evalStats __inet = lastStats; \
+                        evalMode = EVAL_KRIVINE; \
+                        Defvar(__reference, body); \
+                        benchCompare(name, n, __inet, __result, __reference); \
+                    } \
+                    exit(0); \
+                } \
+                int __status; \
+                waitpid(__pid, &__status, 0); \
+                if(!WIFEXITED(__status) || WEXITSTATUS(__status) != 0) benchFailed(name, n, benchModes[__m], __status); \
+            } \
+        } \
+    }
+
+#endif
+
 // ==================
 // USAGE
 // ==================
 
 expr __ImpureIdentity(byte *ptr, size_t len) {
-    byte *nptr = Malloc(len);
+    byte *nptr = termAlloc(len);
     memcpy(nptr, ptr, len);
     return (expr){ .aux = false, .data = nptr, .len = len };
 }
@@ -821,6 +6878,10 @@ DefunImpure(ImpureIncrement, uint64_t, num, {
 });
 
 int main() {
+#ifdef PRELUDE_IMAGE
+    imageOpen(PRELUDE_IMAGE);
+#endif
+
     // Zero and Successor
     Defun(Zero, s, Fun(z, Bind(z)));
     Defun(Succ, w, Fun(y, Fun(x, App(Bind(y), App(App(Bind(w), Bind(y)), Bind(x))))));
@@ -887,12 +6948,12 @@ int main() {
     // Sum via Y combinator
     Defun(SumNatAux, r, Fun(n, App(App(App(IsZero, Bind(n)), Zero), App(App(Bind(n), Succ), App(Bind(r), App(Pred, Bind(n)))))));
     DefunLazy(SumNat, n, App(App(YC, SumNatAux), Bind(n)));
-    Defvar(SumTwelve, App(SumNat, Twelve));
+    DefvarUsing(SumTwelve, EVAL_KRIVINE, App(SumNat, Twelve));
 
     // Factorial via Y combinator
     Defun(FactAux, f, Fun(n, App(App(App(IsZero, Bind(n)), One), App(App(Mul, Bind(n)), App(Bind(f), App(Pred, Bind(n)))))));
     DefunLazy(Fact, n, App(App(YC, FactAux), Bind(n)));
-    Defvar(FactFive, App(Fact, Five));
+    DefvarUsing(FactFive, EVAL_KRIVINE, App(Fact, Five));
 
     // Defining impure values for confirming results
     DefvarImpure(ImpureZero, uint64_t, 0);
@@ -904,6 +6965,23 @@ int main() {
     Defun(CheckNumber, n, App(App(Bind(n), ImpureIncrement), ImpureZero));
     Defun(CheckBool, b, App(App(Bind(b), ImpureTrue), ImpureFalse));
 
+#ifdef PRELUDE_IMAGE
+    imageClose();
+#endif
+
+#ifdef BENCHMARK
+    Bench("church-sum", App(CheckNumber, App(App(Sum, Church(n)), Church(n))), 50, 100, 200);
+    Bench("church-mul", App(CheckNumber, App(App(Mul, Church(n)), Church(n))), 5, 10, 20);
+    Bench("church-large", App(CheckNumber, Church(n)), 250, 500, 1000, 2000);
+    Bench("pred", App(CheckNumber, App(Pred, Church(n))), 25, 50, 100, 200);
+    Bench("compare", App(CheckBool, App(App(IsLessOrEqual, Church(n)), Church(n))), 5, 10, 20);
+    Bench("fact", App(CheckNumber, App(Fact, Church(n))), 3, 4, 5);
+    Bench("sumnat", App(CheckNumber, App(SumNat, Church(n))), 4, 8, 12, 16);
+    Bench("mul-normal", App(App(Mul, Church(n)), Church(n)), 20, 40, 80);
+    Bench("fact-pair", Fun(p, App(App(Bind(p), App(Fact, Church(n))), App(Fact, Church(n)))), 3, 4, 5);
+    return 0;
+#endif
+
     Defvar(CheckTwenty, App(CheckNumber, Twenty));
     printf("Twenty evaluates to: %lu\n", ReadVarImpure(CheckTwenty, uint64_t));
 
@@ -943,6 +7021,75 @@ int main() {
     Defvar(CheckFactFive, App(CheckNumber, FactFive));
     printf("Five factorial evaluates to: %lu\n", ReadVarImpure(CheckFactFive, uint64_t));
 
+    DefvarUsing(FactPair, EVAL_PARALLEL, Fun(p, App(App(Bind(p), App(Fact, Four)), App(Fact, Five))));
+    Defvar(CheckFactPair, App(CheckNumber, App(FactPair, Sum)));
+    printf("Four factorial plus five factorial, both normalized in parallel: %lu\n", ReadVarImpure(CheckFactPair, uint64_t));
+
+    // Evaluating a step budget at a time, and cutting off a term that never
+    // reaches a normal form
+    DefvarLazy(CheckFactThree, App(CheckNumber, App(Fact, Three)));
+    evalHandle factThree = evalStart(CheckFactThree);
+    int slices = 1;
+    while(evalRun(&factThree, 100, 0) == EVAL_EXHAUSTED) slices++;
+    printf("Three factorial in slices of 100 steps evaluates to: %lu (%s)\n", ReadVarImpure(factThree.term, uint64_t), slices > 1 ? "resumed" : "one slice");
+    evalFree(&factThree);
+
+    DefvarLazy(Runaway, App(YC, Succ));
+    evalHandle runaway = evalStart(Runaway);
+    int runawayStatus = evalRun(&runaway, 1000, 0);
+    printf("YC Succ after 1000 steps: %s\n", runawayStatus == EVAL_NORMAL ? "normal form" : "cut off");
+    evalFree(&runaway);
+
+    evalHandle unlimited = evalStart(CheckFactThree);
+    printf("Three factorial with no step budget: %s\n", evalRun(&unlimited, 0, 0) == EVAL_NORMAL ? "normal form" : "cut off");
+    evalFree(&unlimited);
+
+    // A spine cut off by the budget mustn't be cached as a normal form
+    useNormalCache = true;
+    DefvarLazy(PredPair, Fun(p, App(App(Bind(p), App(Pred, Three)), App(Pred, Four))));
+    evalHandle predPair = evalStart(PredPair);
+    evalRun(&predPair, 2, 0);
+    evalFree(&predPair);
+    Defvar(PredThree, App(Pred, Three));
+    evalHandle predThree = evalStart(PredThree);
+    printf("Pred 3 from the cache after a cut off run: %s\n", evalRun(&predThree, 1, 0) == EVAL_NORMAL ? "normal form" : "not normal");
+    evalFree(&predThree);
+    useNormalCache = false;
+
+    // Native operators leave a diverging argument alone unless normal order
+    // would run it too
+    DefvarUsing(CheckSuccRunawayIsZero, EVAL_NATIVE, App(CheckBool, App(IsZero, App(Succ, App(YC, Succ)))));
+    printf("isZero(YC Succ + 1) with native operators evaluates to: %s\n", boolToStr(ReadVarImpure(CheckSuccRunawayIsZero, bool)));
+
+    // Only the Sum that goes through Succ is its second argument when the
+    // first is zero, this one is that argument η-expanded
+    Defun(Add, x, Fun(y, Fun(s, Fun(z, App(App(Bind(x), Bind(s)), App(App(Bind(y), Bind(s)), Bind(z)))))));
+    DefvarUsing(AddZero, EVAL_NATIVE, Fun(q, App(App(Add, Zero), Bind(q))));
+    printf("λq.Add 0 q with native operators evaluates to: ");
+    printExpr(AddZero);
+
+    // Without brackets a fan carries the last variable out of its λ here,
+    // which readback catches, so interaction nets give it to EVAL_NBE
+    DefvarUsing(FanEscape, EVAL_INET, Fun(a, App(
+        Fun(b, App(Fun(c, App(Fun(d, App(Bind(d), Bind(d))), App(Bind(c), Bind(b)))), Fun(e, App(App(Bind(e), Bind(a)), Fun(f, App(Bind(a), Bind(e))))))),
+        Fun(g, Fun(h, Fun(i, Fun(j, Fun(k, Fun(l, App(App(Bind(i), Bind(j)), Bind(i)))))))))));
+    printf("A variable carried out of its λ by interaction nets: ");
+    printExpr(FanEscape);
+
+    // Independent queries evaluated in one batch, on every core
+    expr squares[16];
+    for(size_t i = 0; i < 16; i++) {
+        Query(Square, App(CheckNumber, App(App(Mul, Church(i)), Church(i))));
+        squares[i] = Square;
+    }
+    evaluateBatch(squares, 16, 0);
+    uint64_t squareSum = 0;
+    for(size_t i = 0; i < 16; i++) {
+        squareSum += ReadVarImpure(squares[i], uint64_t);
+        Free(squares[i].data);
+    }
+    printf("Sum of the squares up to 15, as 16 queries in one batch: %lu\n", squareSum);
+
     // Defvar(Large, Church(60));
     // Defvar(SumNatLarge, App(SumNat, Large));
     // Defvar(CheckSumNatLarge, App(CheckNumber, SumNatLarge));
@@ -950,6 +7097,17 @@ int main() {
 
 #ifdef MEM_STATS
     printf("MALLOC: %ld; FREE: %ld; FINAL: %ld; PEAK: %ld\n", mallocCount, freeCount, finalCount, peakCount);
+    printf("ARENA: %ld bytes; REUSED: %ld; PEAK: %ld\n", arenaBytes, arenaReused, arenaPeak);
+
+    size_t sharedBytes = 0;
+    for(refId i = 0; i < sharedCount; i++) sharedBytes += sharedTable[i].term.len + sharedTable[i].canon.len;
+    printf("SHARED: %u terms; %lu bytes\n", sharedCount, sharedBytes);
+    printf("NORMAL CACHE: %ld hits; %ld misses; %ld evictions\n", normalCacheHits, normalCacheMisses, normalCacheEvictions);
+    printf("GRAPH: %ld collections; %ld nodes freed; %lu nodes reserved\n", graphCollections, graphFreed, graphCapacity);
+    printf("NATIVE: %ld operations\n", nativeOps);
+    printf("PARALLEL: %ld jobs\n", parallelJobs);
+    printf("INET: %ld interactions; %ld fallbacks; %u nodes reserved\n", inetInteractions, inetFallbacks, inetCap);
+    printStats(totalStats);
 #endif
 
     return 0;